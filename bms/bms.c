@@ -170,7 +170,9 @@ enum bms_opt { opt_height, opt_width, opt_x, opt_y, opt_range,
 	opt_julia, opt_colours, opt_cx, opt_cy,
 	opt_chunk_width, opt_chunk_height, opt_verbose,
 	opt_nooutput, opt_statistics, opt_version, opt_ascii,
-	opt_colour, opt_spectrum
+	opt_colour, opt_spectrum, opt_guess, opt_solid_guess,
+	opt_guess_samples, opt_nosymmetry, opt_nobalance, opt_deep, opt_exact,
+	opt_deepen, opt_auto_iterations, opt_fractal
 };
 
 struct option {
@@ -199,9 +201,21 @@ struct option options[] = { {opt_height, "height", 1},
 {opt_ascii, "ascii", 0},
 {opt_colour, "colour", 0},
 {opt_colour, "color", 0},
-{opt_spectrum, "spectrum", 1}
+{opt_spectrum, "spectrum", 1},
+{opt_guess, "guess", 0},
+{opt_solid_guess, "solid_guess", 0},
+{opt_guess_samples, "guess_samples", 1},
+{opt_nosymmetry, "nosymmetry", 0},
+{opt_nobalance, "nobalance", 0},
+{opt_deep, "deep", 0},
+{opt_exact, "exact", 0},
+{opt_deepen, "deepen", 1},
+{opt_auto_iterations, "auto_iterations", 0},
+{opt_fractal, "fractal", 1}
 };
 
+char *fractal_names[] = FRACTAL_NAMES;
+
 cmap_error(msg)
 char *msg;
 {
@@ -216,6 +230,9 @@ char **argv;
 	wf_state *workforce;
 	int i, j;
 	char *optarg;
+	char *x_text = "-0.5", *y_text = "0.0";	/* the view center */
+	unsigned limit;		/* the final iteration limit */
+	unsigned deepen = 0;	/* the limit of the first pass, if deepening */
 
 	/* colour stuff */
 	int colour_mode = 0;
@@ -230,10 +247,18 @@ yellow green-yellow-coral-pink-black";
 	/* defaults */
 	bms.ms.width = 64;
 	bms.ms.height = 24;
-	bms.ms.center_x = -0.5;
-	bms.ms.center_y = 0.0;
 	bms.ms.xrange = 4.0;
 	bms.ms.julia = 0;
+	bms.ms.fractal = FRACTAL_MANDELBROT;
+	bms.ms.guess = 0;
+	bms.ms.solid_guess = 0;
+	bms.ms.guess_samples = 1;
+	bms.ms.symmetry = 1;
+	bms.ms.balance = 1;
+	bms.ms.deep = 0;
+	bms.ms.exact = 0;
+	bms.ms.keep_state = 0;
+	bms.ms.auto_iterations = 0;
 	/* bms.ms.c_x... */
 	bms.ms.job.iteration_limit = 250;
 
@@ -259,10 +284,10 @@ yellow green-yellow-coral-pink-black";
 						bms.ms.height = atoi(optarg);
 						break;
 					case opt_x:
-						bms.ms.center_x = atof(optarg);
+						x_text = optarg;
 						break;
 					case opt_y:
-						bms.ms.center_y = atof(optarg);
+						y_text = optarg;
 						break;
 					case opt_range:
 						bms.ms.xrange = atof(optarg);
@@ -311,6 +336,53 @@ yellow green-yellow-coral-pink-black";
 					case opt_spectrum:
 						spectrum = optarg;
 						break;
+					case opt_guess:
+						bms.ms.guess = 1;
+						break;
+					case opt_solid_guess:
+						bms.ms.solid_guess = 1;
+						break;
+					case opt_guess_samples:
+						bms.ms.guess_samples =
+						    atoi(optarg);
+						break;
+					case opt_nosymmetry:
+						bms.ms.symmetry = 0;
+						break;
+					case opt_nobalance:
+						bms.ms.balance = 0;
+						break;
+					case opt_deep:
+						bms.ms.deep = 1;
+						break;
+					case opt_exact:
+						bms.ms.exact = 1;
+						break;
+					case opt_deepen:
+						deepen = atoi(optarg);
+						break;
+					case opt_auto_iterations:
+						bms.ms.auto_iterations = 1;
+						break;
+					case opt_fractal:
+						for (bms.ms.fractal = 0;
+						     bms.ms.fractal < N_FRACTALS;
+						     bms.ms.fractal++)
+							if (strcmp(optarg,
+								   fractal_names
+								   [bms.ms.fractal])
+							    == 0)
+								break;
+						if (bms.ms.fractal == N_FRACTALS)
+							error
+							    ("unknown fractal type");
+						if (bms.ms.fractal ==
+						    FRACTAL_JULIA) {
+							bms.ms.julia = 1;
+							bms.ms.fractal =
+							    FRACTAL_MANDELBROT;
+						}
+						break;
 					default:
 						error
 						    ("internal option procesing error");
@@ -341,7 +413,18 @@ yellow green-yellow-coral-pink-black";
 	bms.ms.bytes_per_count = (bms.ms.job.iteration_limit > 256 ? 2 : 1);
 
 	ms_init(&bms.ms, (char *)&bms,
-		workforce = wf_init(TIMEOUT, IO_MUX_NONE, IO_MUX_SELECT));
+		workforce = wf_init(TIMEOUT, IO_MUX_NONE, IO_MUX_EPOLL));
+	ms_set_center(&bms.ms, x_text, y_text);
+
+	/*
+	   When deepening, the picture is first calculated to the smaller
+	   limit, and the limit is then raised fourfold at a time, with
+	   only the pixels that reached it continued each time.
+	 */
+	if (deepen > 1) {
+		bms.ms.keep_state = 1;
+		bms.ms.first_limit = deepen;
+	}
 
 	ms_calculate_job_parameters(&bms.ms, &bms.ms.job);
 
@@ -366,6 +449,11 @@ yellow green-yellow-coral-pink-black";
 			 bms.ms.height);
 
 	ms_main(&bms.ms);
+	if (deepen > 1 && bms.ms.states)
+		for (limit = bms.ms.pass_limit;
+		     limit < bms.ms.job.iteration_limit;)
+			if (ms_deepen(&bms.ms, limit *= 4))
+				ms_main(&bms.ms);
 
 	/* we have received all the replies; write out the finished picture */
 	if (!nooutput) {
@@ -6,5 +6,7 @@ typedef unsigned char uint8;
 typedef unsigned short uint16;
 typedef unsigned int uint32;
 typedef int sint32;
+typedef unsigned long long uint64;	/* for multiple-precision products */
+typedef long long sint64;	/* for 64-bit fixed point */
 
 #endif				/* _datrep_h */
@@ -19,12 +19,27 @@
     Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#if defined(HAVE_MMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for sendmmsg() and recvmmsg() */
+#endif
+
 #include "inet.h"
 #include "io.h"
 
+#include <string.h>
+#include <sys/time.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 #include <errno.h>
 extern int errno;		/* at least Sony's <errno.h> misses this */
 
+#ifdef NO_BCOPY
+#define bzero(d,n) memset(d,0,n)
+#endif
+
 struct io_state {
 	io_transport trans;	/* transport mechanism */
 	io_multiplex mux;	/* I/O multiplexing and timeout mechanism */
@@ -35,11 +50,28 @@ struct io_state {
 	char *closure;
 	void (*recv_fun) ();
 	void (*tick_fun) ();
+	void (*flush_fun) ();
 	int child_pid;		/* PID of child server, if any */
 	int done;
 	int ignore_ewouldblock;
+	char *batch;		/* buffers for reading IO_BATCH messages */
+	long timer_at;		/* when to tick (see io_now()), or -1 */
+	int epoll_fd;		/* for IO_MUX_EPOLL */
+	int timer_fd;
 };
 
+/* the time in milliseconds since some moment */
+
+static long io_now()
+{
+	static long base;
+	struct timeval tv;
+	gettimeofday(&tv, (struct timezone *)0);
+	if (!base)
+		base = tv.tv_sec;
+	return ((tv.tv_sec - base) * 1000L + tv.tv_usec / 1000);
+}
+
 /* run the tick function */
 
 void io_tick(io)
@@ -54,10 +86,13 @@ io_state *io;
   When a message is received, call recv_fun with the closure,
   message buffer, and message size as arguments.   When a timeout
   occurs, call tick_fun with the closure as the only argument. 
+  When all the messages that had arrived have been passed to
+  recv_fun, call flush_fun with the closure, so that any replies
+  can be sent off together.
 */
 
 io_state *io_init(trans, mux, recv_fd, send_fd, closure, rcvbuf, bufsize,
-		  recv_fun, tick_fun)
+		  recv_fun, tick_fun, flush_fun)
 io_transport trans;		/* transport mechanism */
 io_multiplex mux;		/* I/O multiplexing and timeout mechanism */
 int recv_fd, send_fd;
@@ -66,6 +101,7 @@ char *rcvbuf;			/* buffer to put received messages in */
 int bufsize;			/* size of the above */
 void (*recv_fun) ();		/* function to call on reception of a message */
 void (*tick_fun) ();		/* funtion to call on timeout */
+void (*flush_fun) ();		/* function to call after a batch of messages */
 {
 	io_state *io = (io_state *) malloc(sizeof(io_state));
 	io->trans = trans;
@@ -77,8 +113,32 @@ void (*tick_fun) ();		/* funtion to call on timeout */
 	io->closure = closure;
 	io->recv_fun = recv_fun;
 	io->tick_fun = tick_fun;
+	io->flush_fun = flush_fun;
 	io->done = 0;
 	io->ignore_ewouldblock = 0;
+	io->batch = (char *)0;
+	io->timer_at = -1;
+	io->epoll_fd = io->timer_fd = -1;
+#ifdef HAVE_EPOLL
+	if (mux == IO_MUX_EPOLL) {
+		struct epoll_event ev;
+		io->epoll_fd = epoll_create1(0);
+		io->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (io->epoll_fd == -1 || io->timer_fd == -1)
+			io_error("epoll");
+		ev.events = EPOLLIN;
+		ev.data.fd = recv_fd;
+		if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, recv_fd, &ev) == -1)
+			io_error("epoll_ctl");
+		ev.data.fd = io->timer_fd;
+		if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, io->timer_fd, &ev)
+		    == -1)
+			io_error("epoll_ctl");
+	}
+#else
+	if (mux == IO_MUX_EPOLL)
+		io->mux = IO_MUX_SELECT;
+#endif
 	return (io);
 }
 
@@ -100,6 +160,33 @@ io_state *io;
 	io->ignore_ewouldblock = 1;
 }
 
+/*
+  Call the tick function when "msec" milliseconds have passed, or
+  not specially if "msec" is negative.  This replaces any earlier
+  setting.
+*/
+
+void io_set_timer(io, msec)
+io_state *io;
+long msec;
+{
+	io->timer_at = msec < 0 ? -1 : io_now() + msec;
+#ifdef HAVE_EPOLL
+	if (io->timer_fd != -1) {
+		struct itimerspec its;
+		bzero((char *)&its, sizeof(its));
+		if (msec >= 0) {
+			its.it_value.tv_sec = msec / 1000;
+			/* a zero it_value would disarm the timer */
+			its.it_value.tv_nsec = (msec % 1000) * 1000000L + 1;
+		}
+		if (timerfd_settime(io->timer_fd, 0, &its,
+				    (struct itimerspec *)0) == -1)
+			io_error("timerfd_settime");
+	}
+#endif
+}
+
 int io_send(io, buffer, bufsize, to, tolen)
 io_state *io;
 char *buffer;
@@ -125,6 +212,53 @@ unsigned int tolen;
 	return (status);
 }
 
+/*
+  Send the "n" messages "msgs"; returns the number sent before the
+  first one that couldn't be, which is n if all went well.  With
+  HAVE_MMSG, UDP datagrams go out IO_BATCH at a time with a single
+  system call.
+*/
+
+#define IO_BATCH 64
+
+int io_send_batch(io, msgs, n)
+io_state *io;
+io_message *msgs;
+int n;
+{
+	int i = 0, k;
+#if defined(HAVE_SOCKETS) && defined(HAVE_MMSG)
+	if (io->trans == IO_TRANS_UDP) {
+		struct mmsghdr hdrs[IO_BATCH];
+		struct iovec iov[IO_BATCH];
+		while (i < n) {
+			int m = n - i < IO_BATCH ? n - i : IO_BATCH;
+			for (k = 0; k < m; k++) {
+				iov[k].iov_base = msgs[i + k].buffer;
+				iov[k].iov_len = msgs[i + k].bufsize;
+				bzero((char *)&hdrs[k], sizeof(hdrs[k]));
+				hdrs[k].msg_hdr.msg_name = msgs[i + k].to;
+				hdrs[k].msg_hdr.msg_namelen = msgs[i + k].tolen;
+				hdrs[k].msg_hdr.msg_iov = &iov[k];
+				hdrs[k].msg_hdr.msg_iovlen = 1;
+			}
+			k = sendmmsg(io->send_fd, hdrs, m, 0);
+			if (k < 0 && errno == EINTR)
+				continue;
+			if (k <= 0)
+				break;
+			i += k;
+		}
+		return (i);
+	}
+#endif
+	for (; i < n; i++)
+		if (io_send(io, msgs[i].buffer, msgs[i].bufsize,
+			    msgs[i].to, msgs[i].tolen) == -1)
+			break;
+	return (i);
+}
+
 void io_done(io)
 io_state *io;
 {
@@ -132,9 +266,40 @@ io_state *io;
 }
 
 #ifdef HAVE_SOCKETS
+/*
+  Read the messages that have arrived on the socket, which doesn't
+  block, and pass them on.  With HAVE_MMSG, they are read IO_BATCH at
+  a time with a single system call.
+*/
+
 void io_handle_socket_input(io)
 io_state *io;
 {
+	int n = 0, got;
+#ifdef HAVE_MMSG
+	struct mmsghdr hdrs[IO_BATCH];
+	struct iovec iov[IO_BATCH];
+	int k;
+
+	if (!io->batch)
+		io->batch = (char *)malloc(IO_BATCH * io->bufsize);
+	do {
+		for (k = 0; k < IO_BATCH; k++) {
+			iov[k].iov_base = io->batch + k * io->bufsize;
+			iov[k].iov_len = io->bufsize;
+			bzero((char *)&hdrs[k], sizeof(hdrs[k]));
+			hdrs[k].msg_hdr.msg_iov = &iov[k];
+			hdrs[k].msg_hdr.msg_iovlen = 1;
+		}
+		got = recvmmsg(io->recv_fd, hdrs, IO_BATCH, MSG_DONTWAIT,
+			       (struct timespec *)0);
+		for (k = 0; k < got; k++)
+			(*(io->recv_fun)) (io->closure, io->batch + k * io->bufsize,
+					   (int)hdrs[k].msg_len);
+		if (got > 0)
+			n += got;
+	} while (got == IO_BATCH);
+#else
 	int fromlen = sizeof(NET_ADDRESS);
 	/*
 	   This previously used read(), but some non-BSD TCP/IP implementations
@@ -143,16 +308,19 @@ io_state *io;
 	   for the "from" argument in recvfrom(), the "fromlen" argument 
 	   may not be a null pointer. 
 	 */
-	if (recvfrom(io->recv_fd, io->rcvbuf, io->bufsize,
-		     0, (struct sockaddr *)0, &fromlen) == -1)
-	{
-		if (errno != EWOULDBLOCK || !io->ignore_ewouldblock) {
-			perror("read");
-			io_error("slave input socket read");
-		}
-	} else {
-		(*(io->recv_fun)) (io->closure, io->rcvbuf, io->bufsize);
+	while ((got = recvfrom(io->recv_fd, io->rcvbuf, io->bufsize,
+			       0, (struct sockaddr *)0, &fromlen)) != -1) {
+		(*(io->recv_fun)) (io->closure, io->rcvbuf, got);
+		n++;
+	}
+#endif
+	/* having read some, running out is what we expect */
+	if (got == -1 && errno != EINTR &&
+	    (errno != EWOULDBLOCK || !(n || io->ignore_ewouldblock))) {
+		perror("read");
+		io_error("slave input socket read");
 	}
+	(*(io->flush_fun)) (io->closure);
 }
 #endif				/* HAVE_SOCKETS */
 
@@ -164,8 +332,6 @@ io_state *io;
 	struct timeval tv, zero_tv;
 	zero_tv.tv_sec = 0;
 	zero_tv.tv_usec = 0;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
 
 	/* main loop */
 	while (!io->done) {
@@ -189,13 +355,26 @@ io_state *io;
 			} else if (nready > 0
 				   && FD_ISSET(io->recv_fd, &readfds))
 				io_handle_socket_input(io);
-		} while (nready);
+		} while (nready && !io->done);
+		if (io->done)
+			break;
 
 		/*
 		   No more data; handle any pending timeouts and then go to sleep for
-		   a second or until new data arrive.
+		   a second, or until the timer is due or new data arrive.
 		 */
 		io_tick(io);
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (io->timer_at >= 0) {
+			long left = io->timer_at - io_now();
+			if (left < 0)
+				left = 0;
+			if (left < 1000) {
+				tv.tv_sec = 0;
+				tv.tv_usec = left * 1000;
+			}
+		}
 
  redo_2:
 		FD_ZERO(&readfds);
@@ -213,28 +392,63 @@ io_state *io;
 }
 #endif				/* HAVE_SELECT */
 
+#ifdef HAVE_EPOLL
+void io_main_epoll(io)
+io_state *io;
+{
+	struct epoll_event ev[2];
+	char expirations[8];
+	int n, i;
+
+	while (!io->done) {
+		n = epoll_wait(io->epoll_fd, ev, 2, -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			io_error("epoll_wait");
+		}
+		for (i = 0; i < n && !io->done; i++)
+			if (ev[i].data.fd == io->timer_fd) {
+				(void)read(io->timer_fd, expirations,
+					   sizeof(expirations));
+				io->timer_at = -1;
+				io_tick(io);
+			} else
+				io_handle_socket_input(io);
+	}
+}
+#endif				/* HAVE_EPOLL */
+
 void io_main_nomux(io)
 io_state *io;
 {
 	while (!io->done) {
 		read(io->recv_fd, io->rcvbuf, io->bufsize);
 		(*(io->recv_fun)) (io->closure, io->rcvbuf, io->bufsize);
+		(*(io->flush_fun)) (io->closure);
 	}
 }
 
 /*
   The main poll routine.  This is for the non-X version only; in the X
   version, this functionality is supplied by the main event loop. 
+  It returns when io_done() is called, and may then be called again.
 */
 
 void io_main(io)
 io_state *io;
 {
+	io->done = 0;
 	switch (io->mux) {
 #ifdef HAVE_SELECT
 	case IO_MUX_SELECT:
 		io_main_select(io);
 		break;
+#endif
+#ifdef HAVE_EPOLL
+	case IO_MUX_EPOLL:
+		io_main_epoll(io);
+		break;
 #endif
 	case IO_MUX_NONE:
 		io_main_nomux(io);
@@ -14,23 +14,41 @@
 
    The input multiplexing and timeouts may be based on either the
    XtAppAddInput and XtAddTimeOut mechanisms in Xt (IO_MUX_XT), the
-   select() system call (IO_MUX_SELECT), or a rudimentary mechanism that
-   supports only a single data source and no timeouts (IO_MUX_NONE).
+   select() system call (IO_MUX_SELECT), Linux epoll with a timerfd
+   (IO_MUX_EPOLL, which is select() where there is no epoll), or a
+   rudimentary mechanism that supports only a single data source and
+   no timeouts (IO_MUX_NONE).
+
+   The tick function is called at least once a second, and also when
+   the time given to io_set_timer() is up.  With IO_MUX_EPOLL it is
+   called only then, so the loop sleeps as long as there is nothing
+   to wait for.
 */
 
 typedef enum { IO_TRANS_UDP, IO_TRANS_PIPE } io_transport;
-typedef enum { IO_MUX_XT, IO_MUX_SELECT, IO_MUX_NONE } io_multiplex;
+typedef enum { IO_MUX_XT, IO_MUX_SELECT, IO_MUX_NONE, IO_MUX_EPOLL }
+ io_multiplex;
 
 typedef struct io_state io_state;
 
+/* a message for io_send_batch() */
+typedef struct {
+	char *buffer;
+	int bufsize;
+	char *to;		/* as for io_send() */
+	unsigned int tolen;
+} io_message;
+
 /* methods */
 io_state *io_init();
 void io_deinit();
 void io_main();
 int io_send();
+int io_send_batch();
 void io_done();
 int io_get_recv_fd();
 void io_ignore_ewouldblock();
+void io_set_timer();
 
 void io_handle_socket_input();
 
@@ -0,0 +1,319 @@
+/* mpfix.c - multiple-precision fixed-point arithmetic */
+
+/*
+    This file is part of MandelSpawn, a network Mandelbrot program.
+
+    Copyright (C) 1990-1993 Andreas Gustafsson
+
+    MandelSpawn is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License, version 1,
+    as published by the Free Software Foundation.
+
+    MandelSpawn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License,
+    version 1, along with this program; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+  This file is used both by the client library and by the computation
+  server, which #includes it.  Only what MandelSpawn needs is here:
+  conversions, addition, subtraction and multiplication.  The numbers
+  involved are short enough that schoolbook multiplication is as good
+  as anything.  The computation server has its own, faster routines
+  for the innermost loop (see ms_mp.c).
+*/
+
+#include "datarep.h"
+#include "inet.h"		/* for htonl() and ntohl() */
+#include "mpfix.h"
+
+#define LIMB_RADIX 4294967296.0	/* 2^MP_LIMB_BITS */
+
+/* the sign bit of the integer part */
+#define mp_negative(a) ((a)->l[(a)->limbs - 1] & 0x80000000)
+
+/* r = -a; r may be a */
+
+static void mp_neg(r, a)
+mpfix *r, *a;
+{
+	uint64 carry = 1;
+	int i;
+	r->limbs = a->limbs;
+	for (i = 0; i < a->limbs; i++) {
+		carry += (uint32) ~ a->l[i];
+		r->l[i] = (uint32) carry;
+		carry >>= MP_LIMB_BITS;
+	}
+}
+
+void mp_from_double(r, x, limbs)
+mpfix *r;
+double x;
+int limbs;
+{
+	int negative = x < 0;
+	double f;
+	int i;
+	if (negative)
+		x = -x;
+	r->limbs = limbs;
+	f = (double)(uint32) x;	/* the integer part */
+	r->l[limbs - 1] = (uint32) f;
+	x -= f;
+	for (i = limbs - 2; i >= 0; i--) {
+		x *= LIMB_RADIX;
+		r->l[i] = (uint32) x;
+		x -= (double)r->l[i];
+	}
+	if (negative)
+		mp_neg(r, r);
+}
+
+double mp_to_double(a)
+mpfix *a;
+{
+	mpfix m;
+	double x = 0.0;
+	int i;
+	if (mp_negative(a)) {
+		mp_neg(&m, a);
+		return (-mp_to_double(&m));
+	}
+	/* from the least significant limb up, so that nothing underflows */
+	for (i = 0; i < a->limbs; i++)
+		x = x * (1.0 / LIMB_RADIX) + (double)a->l[i];
+	return (x);
+}
+
+/*
+  Convert a decimal number like "-0.7436438870371587047521915" to
+  "limbs" limbs, correctly rounded down in magnitude.  Returns zero
+  if the string is not such a number (exponents are not accepted).
+*/
+
+int mp_from_string(r, s, limbs)
+mpfix *r;
+char *s;
+int limbs;
+{
+	int negative = 0;
+	uint32 ipart = 0;
+	char *frac, *p;
+	int i;
+
+	if (*s == '-' || *s == '+')
+		negative = (*s++ == '-');
+	for (p = s; *p >= '0' && *p <= '9'; p++)
+		ipart = ipart * 10 + (*p - '0');
+	frac = p;
+	if (*p == '.')
+		for (frac = ++p; *p >= '0' && *p <= '9'; p++);
+	if (*p != '\0' || p == s || (p == s + 1 && *s == '.'))
+		return (0);
+
+	/* the fraction, from its last digit to its first: f = (f + d) / 10 */
+	r->limbs = limbs;
+	for (i = 0; i < limbs; i++)
+		r->l[i] = 0;
+	while (--p >= frac && *p != '.') {
+		uint64 rem;
+		r->l[limbs - 1] = *p - '0';
+		rem = 0;
+		for (i = limbs - 1; i >= 0; i--) {
+			rem = (rem << MP_LIMB_BITS) | r->l[i];
+			r->l[i] = (uint32) (rem / 10);
+			rem %= 10;
+		}
+	}
+	r->l[limbs - 1] = ipart;
+	if (negative)
+		mp_neg(r, r);
+	return (1);
+}
+
+/*
+  Convert "a" to a decimal string with "digits" digits after the
+  decimal point, truncated, in "s".  Returns "s".
+*/
+
+char *mp_to_string(s, a, digits)
+char *s;
+mpfix *a;
+int digits;
+{
+	mpfix m;
+	char *p = s;
+	char buf[16];
+	int n = a->limbs;
+	int i;
+	uint32 ipart;
+
+	m = *a;			/* structure assignment */
+	if (mp_negative(&m)) {
+		*p++ = '-';
+		mp_neg(&m, &m);
+	}
+	ipart = m.l[n - 1];
+	i = 0;
+	do
+		buf[i++] = '0' + ipart % 10;
+	while ((ipart /= 10) != 0);
+	while (i > 0)
+		*p++ = buf[--i];
+	*p++ = '.';
+	/* the fraction, a digit at a time: f = 10 f, and take the integer part */
+	while (digits-- > 0) {
+		uint64 carry = 0;
+		m.l[n - 1] = 0;
+		for (i = 0; i < n; i++) {
+			carry += (uint64) m.l[i] * 10;
+			m.l[i] = (uint32) carry;
+			carry >>= MP_LIMB_BITS;
+		}
+		*p++ = '0' + m.l[n - 1];
+	}
+	*p = '\0';
+	return (s);
+}
+
+/* r = a with "limbs" limbs, truncating or extending the fraction */
+
+void mp_resize(r, a, limbs)
+mpfix *r, *a;
+int limbs;
+{
+	mpfix t;
+	int shift = limbs - a->limbs;
+	int i;
+	t.limbs = limbs;
+	for (i = 0; i < limbs; i++)
+		t.l[i] = (i - shift >= 0) ? a->l[i - shift] : 0;
+	*r = t;			/* structure assignment */
+}
+
+/* r = a + b; all must have the same number of limbs */
+
+void mp_add(r, a, b)
+mpfix *r, *a, *b;
+{
+	uint64 carry = 0;
+	int i;
+	r->limbs = a->limbs;
+	for (i = 0; i < a->limbs; i++) {
+		carry += (uint64) a->l[i] + b->l[i];
+		r->l[i] = (uint32) carry;
+		carry >>= MP_LIMB_BITS;
+	}
+}
+
+/* r = a - b */
+
+void mp_sub(r, a, b)
+mpfix *r, *a, *b;
+{
+	mpfix t;
+	mp_neg(&t, b);
+	mp_add(r, a, &t);
+}
+
+/*
+  r = a * b, truncated.  The product of two n-limb numbers has 2n
+  limbs, of which the n - 1 lowest are fraction bits that don't fit
+  and the highest is an overflow of the integer part.
+*/
+
+void mp_mul(r, a, b)
+mpfix *r, *a, *b;
+{
+	uint32 prod[2 * MP_MAX_LIMBS];
+	mpfix ma, mb;
+	int negative = 0;
+	int n = a->limbs;
+	int i, j;
+
+	if (mp_negative(a)) {
+		mp_neg(&ma, a);
+		a = &ma;
+		negative = !negative;
+	}
+	if (mp_negative(b)) {
+		mp_neg(&mb, b);
+		b = &mb;
+		negative = !negative;
+	}
+	for (i = 0; i < 2 * n; i++)
+		prod[i] = 0;
+	for (i = 0; i < n; i++) {
+		uint64 carry = 0;
+		if (a->l[i] == 0)
+			continue;
+		for (j = 0; j < n; j++) {
+			carry += (uint64) a->l[i] * b->l[j] + prod[i + j];
+			prod[i + j] = (uint32) carry;
+			carry >>= MP_LIMB_BITS;
+		}
+		prod[i + n] = (uint32) carry;
+	}
+	r->limbs = n;
+	for (i = 0; i < n; i++)
+		r->l[i] = prod[i + n - 1];
+	if (negative)
+		mp_neg(r, r);
+}
+
+/* r = a * i, for a small integer i */
+
+void mp_mul_int(r, a, i)
+mpfix *r, *a;
+int i;
+{
+	mpfix m;
+	uint64 carry = 0;
+	int negative = 0;
+	int k;
+	if (mp_negative(a)) {
+		mp_neg(&m, a);
+		a = &m;
+		negative = 1;
+	}
+	if (i < 0) {
+		i = -i;
+		negative = !negative;
+	}
+	r->limbs = a->limbs;
+	for (k = 0; k < a->limbs; k++) {
+		carry += (uint64) a->l[k] * (uint32) i;
+		r->l[k] = (uint32) carry;
+		carry >>= MP_LIMB_BITS;
+	}
+	if (negative)
+		mp_neg(r, r);
+}
+
+/* store a in network format: most significant limb first, big-endian */
+
+void mp_to_net(p, a)
+uint32 *p;
+mpfix *a;
+{
+	int i;
+	for (i = 0; i < a->limbs; i++)
+		p[i] = htonl(a->l[a->limbs - 1 - i]);
+}
+
+void mp_from_net(r, p, limbs)
+mpfix *r;
+uint32 *p;
+int limbs;
+{
+	int i;
+	r->limbs = limbs;
+	for (i = 0; i < limbs; i++)
+		r->l[limbs - 1 - i] = ntohl(p[i]);
+}
@@ -0,0 +1,39 @@
+/* mpfix.h - multiple-precision fixed-point numbers */
+/* Copyright (C) 1990-1993 Andreas Gustafsson */
+
+#ifndef _mpfix_h
+#define _mpfix_h
+
+#include "datarep.h"
+
+/*
+  A multiple-precision fixed-point number is a two's complement
+  integer of "limbs" 32-bit limbs, least significant limb first,
+  scaled so that the most significant limb is the integer part.
+  Thus two limbs give 32 fractional bits, three give 64, and so on.
+  The integer part must stay within the range of a sint32; there is
+  no overflow checking.  The numbers used by MandelSpawn are never
+  much larger than 4 in magnitude.
+*/
+
+#define MP_LIMB_BITS 32
+#define MP_MAX_LIMBS 32		/* 992 fractional bits, about 1e-298 */
+
+typedef struct mpfix {
+	int limbs;		/* number of limbs in use */
+	uint32 l[MP_MAX_LIMBS];	/* least significant first */
+} mpfix;
+
+void mp_from_double();
+double mp_to_double();
+int mp_from_string();
+char *mp_to_string();
+void mp_resize();
+void mp_add();
+void mp_sub();
+void mp_mul();
+void mp_mul_int();
+void mp_to_net();
+void mp_from_net();
+
+#endif				/* _mpfix_h */
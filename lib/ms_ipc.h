@@ -11,7 +11,7 @@
 /* any of the structures defined below */
 
 #define VERSION		5	/* major version */
-#define DATA_FORMAT 	7	/* minor version (name is historical) */
+#define DATA_FORMAT 	15	/* minor version (name is historical) */
 
 /* miscellaneous magic constants */
 
@@ -25,6 +25,7 @@
 #define REPLY_MESSAGE 1
 #define WHO_R_U_MESSAGE 2
 #define I_AM_MESSAGE 3
+#define ABORT_MESSAGE 4
 
 typedef struct {
 	uint16 magic;		/* magic number */
@@ -61,12 +62,37 @@ typedef struct {
 	MessageHeader header;
 	MessageId id;
 	uint32 mi_count;
+	uint16 precision;	/* the arithmetic used; see below */
+	uint16 credit;		/* chunks the server wants in flight; see below */
 	union {
 		uint8 chars[1];
 		uint16 shorts[1];
 	} data;
 } ReplyHeader;
 
+/*
+  Values for the "precision" field of a reply.  The server picks the
+  cheapest arithmetic that is accurate enough for each chunk, and
+  says which it used so that the client can keep statistics.
+*/
+#define PREC_FIXED	0	/* 32-bit fixed point */
+#define PREC_FLOAT	1	/* single-precision floating point */
+#define PREC_DOUBLE	2	/* double-precision floating point */
+#define PREC_DOUBLE_DOUBLE 3	/* pairs of doubles, about 106 bits */
+#define PREC_MP		4	/* multiple-precision fixed point */
+#define PREC_PERTURB	5	/* perturbation of a reference orbit */
+#define PREC_FIXED64	6	/* 64-bit fixed point */
+#define N_PREC		7
+
+/*
+  The "credit" field of a reply.  A server keeps the work requests it
+  hasn't got round to on a stack and calculates the most recent one
+  first, so a client can hide the round trip by keeping several
+  chunks in flight to it.  The credit is how many the server wants
+  the client to keep in flight; a server that can't queue requests
+  says 1.  Zero means the same as 1.
+*/
+
 /* Slave PID inquiry message */
 typedef struct {
 	MessageHeader header;
@@ -78,9 +104,27 @@ typedef struct {
 typedef struct {
 	MessageHeader header;
 	uint16 pid;
-	uint16 pad;
+	uint16 fractals;	/* bit 1 << FRACTAL_xxx for each type drawn */
 } IAmMessage;
 
+/*
+  Abort message: the client no longer wants the chunks listed, or if
+  "n_chunks" is zero, any chunk of the sequence in "id" (whose
+  "chunk_no" and "slave_no" are not used).  The chunk numbers are
+  compared with those of the work requests as such, like the id.
+  A server drops the requests from the same address that match, and
+  stops calculating the current one if it does.
+*/
+#define MAX_ABORT_CHUNKS \
+	((MAX_DATAGRAM - sizeof(MessageHeader) - sizeof(MessageId) - 2) / 2)
+
+typedef struct {
+	MessageHeader header;
+	MessageId id;
+	uint16 n_chunks;	/* number of chunk numbers below, or 0 for all */
+	uint16 chunks[VARIES];
+} AbortMessage;
+
 /* Used when we don't know the message type yet */
 typedef struct {
 	MessageHeader header;
@@ -93,6 +137,7 @@ typedef union {
 	WhipMessage whip;
 	WhoAreYouMessage who;
 	IAmMessage iam;
+	AbortMessage abort;
 } Message;
 
 #endif				/* _ms_ipc_h */
@@ -9,12 +9,40 @@
 
 /* options for the "flags" field */
 #define MS_OPT_INTERIOR	0x0100	/* show speed of convergence in set interior */
-#define MS_OPT_GUESS	0x0200	/* reserved for "guessing" algorithm */
+#define MS_OPT_GUESS	0x0200	/* fill rectangles with uniform borders */
+#define MS_OPT_GRID	0x0400	/* calculate the grid lines only (see below) */
+#define MS_OPT_DEEP	0x0800	/* deep zoom by perturbation (see below) */
+#define MS_OPT_MP	0x1000	/* multiple-precision coordinates (see below) */
+#define MS_OPT_STATE	0x2000	/* return the state of unfinished pixels */
+#define MS_OPT_RESUME	0x4000	/* continue pixels from such states */
+#define MS_OPT_PACK	0x8000	/* the counts of the reply may be packed */
+
+/*
+  Values for the "julia" field.  All but Julia sets vary c with the
+  pixel and start from the z0 of the job.  The Multibrot sets iterate
+  z^d + c, and the Burning Ship iterates (|Re z| + i |Im z|)^2 + c.
+  The Henon map iterates x' = 1 + c.re y + c.im x^2, y' = x, with
+  (x, y) in the place of z.  A server says which types it can draw
+  in its reply to a WHO_R_U_MESSAGE (see ms_ipc.h); it doesn't reply
+  to jobs of other types.
+*/
+#define FRACTAL_MANDELBROT	0
+#define FRACTAL_JULIA		1
+#define FRACTAL_HENON		2
+#define FRACTAL_MULTIBROT3	3
+#define FRACTAL_MULTIBROT4	4
+#define FRACTAL_MULTIBROT5	5
+#define FRACTAL_BURNING_SHIP	6
+#define N_FRACTALS		7
+
+/* their names, for user interfaces */
+#define FRACTAL_NAMES { "mandelbrot", "julia", "henon", "multibrot3", \
+	"multibrot4", "multibrot5", "burning_ship" }
 
 /* this is the part of a calculation request that is common to all */
 /* requests generated for this exposure event */
 struct static_job_info {
-	uint16 julia;		/* fractal type: 0 for Mandelbrot, 1 for Julia set */
+	uint16 julia;		/* fractal type: FRACTAL_xxx (historical name) */
 	uint16 flags;		/* flags and options */
 	netcomplex corner;	/* Corner C for Mandelbrot, C for Julia */
 	netcomplex z0;		/* Z0=0 for Mandelbrot, corner Z for julia */
@@ -39,6 +67,157 @@ typedef struct {
 typedef struct {
 	struct static_job_info j;	/* corner, delta, iterations... */
 	ms_rectangle s;		/* area to calculate */
+	uint16 grid_x;		/* grid line spacing for MS_OPT_GRID */
+	uint16 grid_y;
 } ms_job;
 
+/*
+  With MS_OPT_GRID, only the pixels on the grid lines of the area are
+  calculated: every grid_x'th column and grid_y'th row counting from
+  the first one, and the last row and column.  The reply holds their
+  counts packed together in the usual left-to-right, top-to-bottom
+  order.  MS_GRID_LINES(n, g) is the number of lines across n pixels,
+  MS_GRID_PIXELS() the number of pixels in a reply.
+*/
+#define MS_ON_GRID(n, g, i) ((i) % (g) == 0 || (i) == (n) - 1)
+#define MS_GRID_LINES(n, g) (((n) - 1) / (g) + 1 + (((n) - 1) % (g) != 0))
+#define MS_GRID_PIXELS(w, h, gx, gy) \
+	(MS_GRID_LINES(h, gy) * (w) + \
+	 MS_GRID_LINES(w, gx) * ((h) - MS_GRID_LINES(h, gy)))
+
+/*
+  With MS_OPT_DEEP, the job is a Mandelbrot job too deep for the
+  corner and delta fields, and this structure follows the ms_job.
+  The "data" field holds four multiple-precision fixed-point numbers
+  of "limbs" 32-bit limbs each, most significant limb first (see
+  mpfix.h): the real and imaginary parts of a reference point C
+  somewhere in the picture, and the real and imaginary pixel spacing.
+  The pixel at (x, y) is at C + ((2x - origin_x2) * delta.re / 2,
+  (2y - origin_y2) * delta.im / 2).
+
+  The server iterates the reference point to full precision, and
+  the other pixels as small perturbations of its orbit in ordinary
+  floating point.  The same reference point should be used for every
+  chunk of a picture, so that the server can reuse its orbit.
+*/
+typedef struct {
+	uint16 limbs;		/* number of limbs in each number */
+	uint16 pad;
+	sint32 origin_x2;	/* twice the pixel coordinates of C */
+	sint32 origin_y2;
+	uint32 data[1];		/* C.re, C.im, delta.re, delta.im */
+} ms_deep_job;
+
+#define MS_DEEP_JOB_SIZE(limbs) 	(sizeof(ms_deep_job) + (4 * (limbs) - 1) * sizeof(uint32))
+
+/*
+  With MS_OPT_MP, the corner, z0 and delta fields of the job are
+  replaced by multiple-precision fixed-point numbers of "limbs" limbs
+  each, in this structure following the ms_job; they mean the same as
+  the netcomplex fields, and every pixel is iterated to the full
+  precision.  This is how Julia sets are zoomed beyond the precision
+  of a netreal.  The number of limbs must be 2, 4, 6 or 8 (64, 128,
+  192 or 256 bits), of which the client should use the smallest that
+  is enough for the pixel spacing.
+*/
+typedef struct {
+	uint16 limbs;		/* number of limbs in each number */
+	uint16 pad;
+	uint32 data[1];		/* corner, z0 and delta; .re before .im */
+} ms_mp_job;
+
+#define MS_MP_MAX_LIMBS	8
+#define MS_MP_JOB_SIZE(limbs) 	(sizeof(ms_mp_job) + (6 * (limbs) - 1) * sizeof(uint32))
+
+/*
+  With MS_OPT_STATE, the reply holds after the counts (padded to a
+  multiple of 4 bytes) the state of each pixel whose count reached
+  the iteration limit, in the usual order, so that the pixel can
+  later be continued to a higher limit instead of being calculated
+  all over again.  Pixels found to be inside the set by the interior
+  tests are marked as such and need no continuing.
+
+  With MS_OPT_RESUME, an ms_resume_job follows the ms_job with the
+  states of the pixels to continue, in the usual order; the chunk
+  must be the one they came from, with only the iteration limit
+  changed.  Only those pixels are calculated, and the counts of the
+  others in the reply are zero.  The two options can be combined,
+  but not with MS_OPT_GUESS, MS_OPT_GRID, MS_OPT_DEEP or MS_OPT_MP,
+  and the chunk may have at most MS_STATE_MAX_PIXELS pixels so that
+  both the job and the reply fit in a datagram.
+*/
+#define MS_STATE_INSIDE	0xFFFFFFFF	/* "iterations" of an interior pixel */
+#define MS_STATE_MAX_PIXELS	320
+#define MS_STATE_OFFSET(n_counts, bytes_per_count) \
+	(((n_counts) * (bytes_per_count) + 3) & ~3)
+
+typedef struct {
+	uint32 iterations;	/* the number done, or MS_STATE_INSIDE */
+	uint32 z[4];		/* z.re and z.im as IEEE doubles, high word first */
+} ms_pixel_state;
+
+typedef struct {
+	uint16 index;		/* of the pixel in the chunk, row by row */
+	uint16 pad;
+	ms_pixel_state state;
+} ms_resume_pixel;
+
+typedef struct {
+	uint16 n_pixels;
+	uint16 pad;
+	ms_resume_pixel pixels[1];
+} ms_resume_job;
+
+#define MS_RESUME_JOB_SIZE(n) 	(sizeof(ms_resume_job) + ((n) - 1) * sizeof(ms_resume_pixel))
+
+/*
+  With MS_OPT_PACK, the counts of the reply are preceded by an
+  ms_packed header saying how they are coded, and the chunk may be
+  larger than a datagram would hold uncoded: up to MS_PACK_MAX_PIXELS
+  pixels, and no more than MS_PACK_MAX_ROW wide or high.  The option
+  can't be combined with MS_OPT_STATE or MS_OPT_RESUME.
+
+  MS_PACK_RAW: the counts follow as usual.
+
+  MS_PACK_UNIFORM: every count is "value"; nothing follows.
+
+  MS_PACK_RUNS: "value" bytes follow, coding the counts in the usual
+  order as a series of runs and deltas from the count before (zero
+  before the first one).  A byte b below 0x80 stands for b + 1 counts
+  equal to the one before.  Otherwise (b & 0x7F) + 1 counts follow,
+  each as its difference d from the count before, coded as the
+  unsigned number 2d if d >= 0 and -2d - 1 if not, seven bits at a
+  time, least significant first, with the top bit set in every byte
+  but the last.  Counts are taken modulo 2^16 (or 2^8).
+
+  MS_PACK_SPLIT: the counts didn't fit in a datagram however coded;
+  nothing follows.  The client should send the chunk in smaller pieces.
+
+  The server picks whichever is shortest.
+*/
+#define MS_PACK_RAW	0
+#define MS_PACK_UNIFORM	1
+#define MS_PACK_RUNS	2
+#define MS_PACK_SPLIT	3
+
+#define MS_PACK_MAX_PIXELS	16384
+#define MS_PACK_MAX_ROW		4096
+
+#define MS_PACK_MAX_RUN		128	/* counts in a run byte */
+#define MS_PACK_MAX_DELTAS	128	/* deltas after a delta byte */
+
+typedef struct {
+	uint16 encoding;	/* MS_PACK_xxx */
+	uint16 value;		/* the count, or the number of bytes, or 0 */
+} ms_packed;
+
+/* convert the double "d" to and from the two words at "w" */
+#define MS_DOUBLE_TO_NET(d, w) \
+	do { uint64 u_; bcopy((char *) &(d), (char *) &u_, sizeof(u_)); \
+	     (w)[0] = htonl((uint32) (u_ >> 32)); \
+	     (w)[1] = htonl((uint32) u_); } while (0)
+#define MS_NET_TO_DOUBLE(w, d) \
+	do { uint64 u_ = ((uint64) ntohl((w)[0]) << 32) | ntohl((w)[1]); \
+	     bcopy((char *) &u_, (char *) &(d), sizeof(u_)); } while (0)
+
 #endif				/* _ms_job_h */
@@ -19,7 +19,10 @@ complement fixed-point number with a 7 bit integer part and 25 bit
 fractional part, transmitted in network byte order.  The "double" type
 is the native C "double" on the client machine.  The "real" type is
 currently the same as "netreal" on 680x0, Vax, 80386, and MIPS
-processors, and a native C "double" on all other machines. */
+processors, and a native C "double" on all other machines, unless
+the server is compiled with REAL_FIXED64 defined, in which case it
+is a 64-bit fixed-point number with a 7 bit integer part and 57 bit
+fractional part. */
 
 #ifndef _ms_real_h
 #define _ms_real_h
@@ -50,8 +53,17 @@ processors, and a native C "double" on all other machines. */
 #endif
 #endif
 
+/* 64-bit fixed point, if asked for; it needs 128-bit products */
+#ifdef REAL_FIXED64
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__)
+#undef REAL_FIXED
+#else
+#error "REAL_FIXED64 needs a compiler with 128-bit integers"
+#endif
+#endif
+
 /* All others machines use doubles */
-#ifndef REAL_FIXED
+#if !defined(REAL_FIXED) && !defined(REAL_FIXED64)
 #define REAL_DOUBLE		/* use floating-point arithmetic */
 #endif
 
@@ -80,6 +92,7 @@ typedef double real;
 #define four_real() (4.0)
 #define int_to_real(x) ((double)(x))
 #define double_to_real(x) (x)
+#define real_to_double(x) (x)
 #define fixed_to_real(x) fixed_to_double(x)
 #endif
 
@@ -98,7 +111,28 @@ typedef fixed real;
 #define four_real() (one_fixed()*4L)
 #define int_to_real(x) ((x) << RIGHTBITS)
 #define double_to_real(x) double_to_fixed(x)
+#define real_to_double(x) fixed_to_double(x)
 #define fixed_to_real(x) (x)
+#define REAL_RIGHTBITS RIGHTBITS
+#endif
+
+/* the same for 64-bit fixed-point numbers */
+#ifdef REAL_FIXED64
+typedef sint64 real;
+#define REAL_RIGHTBITS (64-LEFTBITS)
+#define add_real(x,y) ((x)+(y))
+#define sub_real(x,y) ((x)-(y))
+#define mul_real(x,y) fracmult(x,y)
+#define mul_real_int(x,i) ((x)*(sint64)(i))
+#define gteq_real(x,y) ((x)>=(y))
+#define twice_mul_real(x,y) fracmult2(x,y)
+#define zero_real() ((sint64)0)
+#define one_real() ((sint64)1 << REAL_RIGHTBITS)
+#define four_real() (one_real()*4)
+#define int_to_real(x) ((sint64)(x) << REAL_RIGHTBITS)
+#define double_to_real(x) ((real)((x) * (double)one_real()))
+#define real_to_double(x) ((double)(x) * (1/(double)one_real()))
+#define fixed_to_real(x) ((sint64)(x) << (REAL_RIGHTBITS-RIGHTBITS))
 #endif
 
 /* these defines reflect the fact that the "net" type is currently "fixed" */
@@ -19,11 +19,26 @@
     Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#include <stdlib.h>		/* for qsort() */
+#include <string.h>
+
 #include "datarep.h"
 #include "ms_ipc.h"		/* for byteorder conversion functions */
 #include "mspawn.h"
 #include "work.h"
 
+/*
+  It is impossible to declare malloc() in a portable way.
+  Be prepared to change these declarations. 
+*/
+void *malloc();
+void free();
+double atof();
+
+#ifdef NO_BCOPY
+#define bcopy(s,d,n) memcpy(d,s,n)
+#endif
+
 void ms_init(ms, client, wf)
 ms_state *ms;
 char *client;
@@ -34,6 +49,256 @@ struct wf_state *wf;
 	ms->mi_count = 0L;	/* done no iterations yet */
 	ms->chunks_out = 0;
 	ms->configuration = 0;
+	ms->deep_limbs = ms->mp_limbs = 0;
+	ms->job_ext = (char *)0;
+	ms->job_ext_size = 0;
+	ms->counts = (unsigned short *)0;
+	ms->states = (ms_pixel_state *) 0;
+	ms->first_limit = 0;
+}
+
+/*
+  Set the view center from decimal strings like those given on the
+  command line, keeping all their digits for deep zooming.  Strings
+  in other formats, like "1e-3", are converted via a double.  A null
+  string leaves that coordinate unchanged.
+*/
+
+static void set_coordinate(a, s)
+mpfix *a;
+char *s;
+{
+	if (!mp_from_string(a, s, MP_MAX_LIMBS))
+		mp_from_double(a, atof(s), MP_MAX_LIMBS);
+}
+
+void ms_set_center(ms, x, y)
+ms_state *ms;
+char *x, *y;
+{
+	if (x)
+		set_coordinate(&ms->center_re, x);
+	if (y)
+		set_coordinate(&ms->center_im, y);
+}
+
+/*
+  Print a coordinate in "s" with enough digits to tell apart points
+  "spacing" apart, and a few more.  Returns "s", which should have
+  room for MS_COORD_TEXT_SIZE characters.
+*/
+
+char *ms_coordinate_text(s, a, spacing)
+char *s;
+mpfix *a;
+double spacing;
+{
+	int digits = 6;
+	double d;
+	for (d = spacing; d < 1.0 && digits < MS_COORD_TEXT_SIZE - 20; d *= 10)
+		digits++;
+	return (mp_to_string(s, a, digits));
+}
+
+/*
+  Deep zoom.  When the pixel spacing is too small for the fixed-point
+  corner and delta of the job, Mandelbrot pictures are sent as
+  MS_OPT_DEEP jobs instead (see ms_job.h).  The reference point is
+  the view center, and it is given with one integer limb and enough
+  fraction limbs for at least 32 bits beyond the pixel spacing.
+*/
+
+#define DEEP_SPACING (1.0 / (1 << 18))	/* deepest spacing for normal jobs */
+
+static void alloc_job_ext(ms)
+ms_state *ms;
+{
+	if (!ms->job_ext)
+		ms->job_ext = (char *)
+		    malloc(MAX(MS_DEEP_JOB_SIZE(MP_MAX_LIMBS),
+			       MS_MP_JOB_SIZE(MS_MP_MAX_LIMBS)));
+}
+
+static void deep_job_parameters(ms)
+ms_state *ms;
+{
+	ms_deep_job *dj;
+	double d = ms->xrange / ms->width;
+	int limbs = 2;
+	double s;
+	mpfix t;
+
+	for (s = d; s < 1.0 && limbs < MP_MAX_LIMBS; s *= 4294967296.0)
+		limbs++;
+	alloc_job_ext(ms);
+	dj = (ms_deep_job *) ms->job_ext;
+	ms->deep_limbs = limbs;
+	ms->job_ext_size = MS_DEEP_JOB_SIZE(limbs);
+	dj->limbs = htons(limbs);
+	dj->pad = 0;
+	dj->origin_x2 = htonl(ms->width);
+	dj->origin_y2 = htonl(ms->height);
+
+	mp_resize(&t, &ms->center_re, limbs);
+	mp_to_net(&dj->data[0], &t);
+	mp_resize(&t, &ms->center_im, limbs);
+	mp_to_net(&dj->data[limbs], &t);
+	mp_from_double(&t, d, limbs);
+	mp_to_net(&dj->data[2 * limbs], &t);
+	mp_from_double(&t, ms->yrange / ms->height, limbs);
+	mp_to_net(&dj->data[3 * limbs], &t);
+}
+
+/*
+  Multiple-precision jobs (MS_OPT_MP) are used instead for Julia sets,
+  which can't be done by perturbation, and for Mandelbrot pictures if
+  asked for.  They are given just enough limbs for MP_GUARD_BITS bits
+  beyond the pixel spacing; mp_job_limbs() returns zero if even the
+  largest number of limbs is not enough.
+*/
+
+#define MP_GUARD_BITS 12
+
+static int mp_job_limbs(d)
+double d;
+{
+	int limbs;
+	int bits = MP_GUARD_BITS;
+	double s;
+	for (s = d; s < 1.0; s *= 2.0)
+		bits++;
+	for (limbs = 2; limbs <= MS_MP_MAX_LIMBS; limbs += 2)
+		if ((limbs - 1) * MP_LIMB_BITS >= bits)
+			return (limbs);
+	return (0);
+}
+
+static void mp_job_parameters(ms, limbs)
+ms_state *ms;
+int limbs;
+{
+	ms_mp_job *mj;
+	mpfix z0_re, z0_im, c_re, c_im, t;
+
+	alloc_job_ext(ms);
+	mj = (ms_mp_job *) ms->job_ext;
+	ms->mp_limbs = limbs;
+	ms->job_ext_size = MS_MP_JOB_SIZE(limbs);
+	mj->limbs = htons(limbs);
+	mj->pad = 0;
+
+	/* the corner of the view */
+	mp_resize(&z0_re, &ms->center_re, limbs);
+	mp_from_double(&t, ms->xrange / 2.0, limbs);
+	mp_sub(&z0_re, &z0_re, &t);
+	mp_resize(&z0_im, &ms->center_im, limbs);
+	mp_from_double(&t, ms->yrange / 2.0, limbs);
+	mp_sub(&z0_im, &z0_im, &t);
+	if (ms->julia) {
+		mp_from_double(&c_re, ms->c_x, limbs);
+		mp_from_double(&c_im, ms->c_y, limbs);
+	} else {
+		c_re = z0_re;	/* structure assignment */
+		c_im = z0_im;
+		mp_from_double(&z0_re, 0.0, limbs);
+		mp_from_double(&z0_im, 0.0, limbs);
+	}
+	mp_to_net(&mj->data[0], &c_re);
+	mp_to_net(&mj->data[limbs], &c_im);
+	mp_to_net(&mj->data[2 * limbs], &z0_re);
+	mp_to_net(&mj->data[3 * limbs], &z0_im);
+	mp_from_double(&t, ms->xrange / ms->width, limbs);
+	mp_to_net(&mj->data[4 * limbs], &t);
+	mp_from_double(&t, ms->yrange / ms->height, limbs);
+	mp_to_net(&mj->data[5 * limbs], &t);
+}
+
+/*
+  Incremental deepening.  With "keep_state" set, the servers return
+  the state of each pixel that reaches the iteration limit
+  (MS_OPT_STATE in ms_job.h), and the counts and states of the whole
+  picture are kept here so that ms_deepen() can later send out only
+  those pixels to be continued to a higher limit.  The pixels at
+  their limit are drawn with the count of the picture's limit, as
+  if they were inside.  The first pass is calculated to "first_limit"
+  if it is set.  The chunks are made small enough for the states to
+  fit in a reply, and neither guessing nor mirroring is used, since
+  the pixels they fill in would have no state.  Deep zoom jobs and
+  interior structure have no state either; those pictures are simply
+  calculated to the full limit.
+
+  With "auto_iterations", the limit is chosen chunk by chunk: the
+  picture is first calculated to AUTO_FIRST_LIMIT, and each chunk
+  is then continued as long as there are pixels escaping late in it
+  or next to it (see auto_deepen()).  The iteration limit of the
+  picture is only a ceiling.
+*/
+
+#define AUTO_FIRST_LIMIT 64
+
+static void state_parameters(ms, j)
+ms_state *ms;
+struct static_job_info *j;
+{
+	if (ms->counts) {
+		free((char *)ms->counts);
+		free((char *)ms->states);
+		ms->counts = (unsigned short *)0;
+		ms->states = (ms_pixel_state *) 0;
+	}
+	if (!(ms->keep_state || ms->auto_iterations) || ms->show_interior ||
+	    ms->deep_limbs || ms->mp_limbs || j->julia > FRACTAL_JULIA)
+		return;
+	ms->counts = (unsigned short *)
+	    malloc(ms->width * ms->height * sizeof(unsigned short));
+	ms->states = (ms_pixel_state *)
+	    malloc(ms->width * ms->height * sizeof(ms_pixel_state));
+	ms->pass_limit = ms->auto_iterations ? AUTO_FIRST_LIMIT :
+	    ms->first_limit;
+	if (ms->pass_limit == 0 || ms->pass_limit > j->iteration_limit)
+		ms->pass_limit = j->iteration_limit;
+	ms->job_chunk_width = MIN(ms->job_chunk_width, MS_STATE_MAX_PIXELS);
+	ms->job_chunk_height = MIN(ms->job_chunk_height,
+				   MS_STATE_MAX_PIXELS / ms->job_chunk_width);
+}
+
+/*
+  Symmetry.  The Mandelbrot and Multibrot sets are symmetric about the
+  real axis and every Julia set about the origin, so when the picture contains the
+  axis or the origin, part of it is a mirror image of another part
+  and need not be calculated.  For this to work exactly, the axis must
+  fall on a row of pixels or halfway between two; if it doesn't, the
+  corner of the picture is moved by less than half a pixel so that it
+  does.  This is exact since the corner and the pixel spacing are
+  fixed-point numbers in the job.
+
+  snap_axis() does this for one coordinate: "c" is the coordinate of
+  the first pixel, "d" the spacing and "n" the number of pixels.  It
+  returns the sum k of the indices of any two pixels that are mirror
+  images of each other (the image of pixel i is pixel k - i), or -1 if
+  the axis is not in the picture.
+*/
+
+static int snap_axis(c, d, n)
+netreal *c;
+netreal d;
+unsigned n;
+{
+	double x;
+	long k;
+	if (d <= 0 || n == 0)
+		return (-1);
+	x = -2.0 * (double)*c / (double)d;
+	if (x < -0.5 || x > 2.0 * (n - 1) + 0.5)
+		return (-1);
+	k = (long)(x + 0.5);
+	/* c = -k * d / 2 must be a whole number */
+	if ((k & 1) && (d & 1))
+		k += (x > k || k == 0) ? 1 : -1;
+	if (k > 2 * (long)(n - 1))
+		return (-1);
+	*c = (netreal) (-((double)k * (double)d) / 2.0);
+	return ((int)k);
 }
 
 /*
@@ -45,79 +310,1063 @@ void ms_calculate_job_parameters(ms, j)
 ms_state *ms;
 struct static_job_info *j;
 {
+	double center_x = mp_to_double(&ms->center_re);
+	double center_y = mp_to_double(&ms->center_im);
+	double d;
+	int limbs;
+
 	ms->yrange = ms->xrange * ((double)ms->height / (double)ms->width);
-	j->julia = ms->julia;
-	if (j->julia) {		/* Julia mode */
-		j->z0.re = double_to_net(ms->center_x - ms->xrange / 2.0);
-		j->z0.im = double_to_net(ms->center_y - ms->yrange / 2.0);
+	j->julia = ms->julia ? FRACTAL_JULIA : ms->fractal;
+	if (j->julia == FRACTAL_JULIA) {	/* Julia mode */
+		j->z0.re = double_to_net(center_x - ms->xrange / 2.0);
+		j->z0.im = double_to_net(center_y - ms->yrange / 2.0);
 		j->corner.re = double_to_net(ms->c_x);
 		j->corner.im = double_to_net(ms->c_y);
-	} else {		/* Mandelbrot */
-		j->corner.re = double_to_net(ms->center_x - ms->xrange / 2.0);
-		j->corner.im = double_to_net(ms->center_y - ms->yrange / 2.0);
+	} else {		/* Mandelbrot and the other c-plane types */
+		j->corner.re = double_to_net(center_x - ms->xrange / 2.0);
+		j->corner.im = double_to_net(center_y - ms->yrange / 2.0);
 		j->z0.re = double_to_net(0.0);
 		j->z0.im = double_to_net(0.0);
 	}
 	j->delta.re = double_to_net(ms->xrange / ms->width);
 	j->delta.im = double_to_net(ms->yrange / ms->height);
+
+	ms->deep_limbs = ms->mp_limbs = 0;
+	d = ms->xrange / ms->width;
+	if ((ms->deep || d < DEEP_SPACING) && j->julia <= FRACTAL_JULIA) {
+		limbs = mp_job_limbs(d);
+		if (j->julia == FRACTAL_JULIA)
+			mp_job_parameters(ms, limbs ? limbs : MS_MP_MAX_LIMBS);
+		else if (ms->exact && limbs)
+			mp_job_parameters(ms, limbs);
+		else
+			deep_job_parameters(ms);
+	}
+
+	ms->job_chunk_width = MIN(ms->chunk_width, MS_PACK_MAX_ROW);
+	ms->job_chunk_height = MIN(MIN(ms->chunk_height, MS_PACK_MAX_ROW),
+				   MS_PACK_MAX_PIXELS / ms->job_chunk_width);
+
+	state_parameters(ms, j);
+
+	ms->sym_kx = ms->sym_ky = -1;
+	if (ms->symmetry && !ms->deep_limbs && !ms->mp_limbs &&
+	    j->julia != FRACTAL_HENON && j->julia != FRACTAL_BURNING_SHIP) {
+		if (j->julia == FRACTAL_JULIA) {
+			int kx = snap_axis(&j->z0.re, j->delta.re, ms->width);
+			int ky = snap_axis(&j->z0.im, j->delta.im, ms->height);
+			if (kx >= 0 && ky >= 0) {
+				ms->sym_kx = kx;
+				ms->sym_ky = ky;
+			}
+		} else
+			ms->sym_ky = snap_axis(&j->corner.im, j->delta.im,
+					       ms->height);
+	}
+	/* the corner is snapped all the same, so that the picture is too */
+	if (ms->states)
+		ms->sym_kx = ms->sym_ky = -1;
 }
 
-void ms_dispatch_chunk(ms, client, rect)
+/*
+  The part of a rectangle that can be filled in by reflection: the
+  pixels whose mirror images are in the rectangle and above them.
+  Returns zero if there is none.
+*/
+
+static int mirror_part(ms, rx, ry, rwidth, rheight, q)
+ms_state *ms;
+unsigned rx, ry, rwidth, rheight;
+ms_rectangle *q;
+{
+	long x0, x1, y0, y1;
+	if (ms->sym_ky < 0)
+		return (0);
+	y0 = MAX((long)ry, ms->sym_ky / 2 + 1);
+	y1 = MIN((long)(ry + rheight) - 1, ms->sym_ky - (long)ry);
+	if (ms->sym_kx >= 0) {
+		x0 = MAX((long)rx, ms->sym_kx - (long)(rx + rwidth) + 1);
+		x1 = MIN((long)(rx + rwidth) - 1, ms->sym_kx - (long)rx);
+	} else {
+		x0 = rx;
+		x1 = rx + rwidth - 1;
+	}
+	if (y0 > y1 || x0 > x1)
+		return (0);
+	q->x = x0;
+	q->y = y0;
+	q->width = x1 - x0 + 1;
+	q->height = y1 - y0 + 1;
+	return (1);
+}
+
+/*
+  The part of the mirror image of "r" that lies in "q"; its width and
+  height are zero if there is none.
+*/
+
+static ms_rectangle mirror_of(ms, r, q)
+ms_state *ms;
+ms_rectangle r;
+ms_rectangle *q;
+{
+	ms_rectangle m;
+	long x0, x1, y0, y1;
+	m.x = m.y = m.width = m.height = 0;
+	if (!q)
+		return (m);
+	y0 = MAX(ms->sym_ky - (long)(r.y + r.height) + 1, (long)q->y);
+	y1 = MIN(ms->sym_ky - (long)r.y, (long)(q->y + q->height) - 1);
+	if (ms->sym_kx >= 0) {
+		x0 = MAX(ms->sym_kx - (long)(r.x + r.width) + 1, (long)q->x);
+		x1 = MIN(ms->sym_kx - (long)r.x, (long)(q->x + q->width) - 1);
+	} else {
+		x0 = MAX((long)r.x, (long)q->x);
+		x1 = MIN((long)(r.x + r.width), (long)(q->x + q->width)) - 1;
+	}
+	if (y0 <= y1 && x0 <= x1) {
+		m.x = x0;
+		m.y = y0;
+		m.width = x1 - x0 + 1;
+		m.height = y1 - y0 + 1;
+	}
+	return (m);
+}
+
+/*
+  Draw the mirror image of the counts "data" of the chunk described
+  by "info" in the area info->mirror.  This must be done before the
+  chunk itself is drawn, since ms_draw() may modify the counts.
+*/
+
+static void reflect(ms, info, data)
+ms_state *ms;
+ms_client_info *info;
+char *data;
+{
+	ms_client_info mirror_info;
+	ms_rectangle *s = &info->s;
+	ms_rectangle *m = &info->mirror;
+	unsigned bpc = ms->bytes_per_count;
+	char *buf = (char *)malloc(m->width * m->height * bpc);
+	char *p = buf, *q;
+	long x, y, sx, sy;
+	for (y = m->y; y < m->y + m->height; y++) {
+		sy = info->mirror_ky - y;
+		for (x = m->x; x < m->x + m->width; x++) {
+			sx = info->mirror_kx >= 0 ? info->mirror_kx - x : x;
+			q = data + ((sy - s->y) * s->width + (sx - s->x)) * bpc;
+			*p++ = *q++;
+			if (bpc == 2)
+				*p++ = *q;
+		}
+	}
+	mirror_info = *info;	/* structure assignment */
+	mirror_info.s = *m;
+	mirror_info.mirror.width = mirror_info.mirror.height = 0;
+	ms_draw(ms->client, (char *)&mirror_info, buf);
+	free(buf);
+}
+
+/* the state of solid guessing in a rectangle; see grid_dispatch() */
+
+struct ms_grid {
+	unsigned int configuration;	/* the configuration at dispatch time */
+	unsigned x, y, width, height;	/* the rectangle */
+	unsigned tile_width, tile_height;
+	unsigned grid_x, grid_y;	/* the grid line spacing */
+	unsigned blocks_out;	/* number of grid replies still to come */
+	unsigned short *counts;	/* the grid line counts, in host order */
+	int has_mirror;		/* true if "mirror" is valid */
+	ms_rectangle mirror;	/* the area to fill by reflection */
+};
+
+/* a coarse preview of a rectangle for cost balancing; see preview_dispatch() */
+
+struct ms_preview {
+	unsigned int configuration;	/* the configuration at dispatch time */
+	unsigned x, y, width, height;	/* the rectangle */
+	unsigned step;		/* pixels between samples */
+	unsigned nx, ny;	/* samples across and down */
+	double *sums;		/* cost of the samples above and left of each */
+	int has_mirror;		/* true if "mirror" is valid */
+	ms_rectangle mirror;	/* the area to fill by reflection */
+};
+
+/*
+  Send out a chunk to be calculated, or only its grid lines if "grid"
+  is non-NULL (see below).  If "q" is non-NULL, the part of the mirror
+  image of the chunk that lies in "q" will be filled in when the chunk
+  arrives.  If "resume" is non-NULL, only the pixels in it are
+  continued (see ms_deepen()).  "limit" is the iteration limit.  If
+  "preview" is non-NULL, "rect" is in its samples (see below).
+*/
+
+static void send_job(ms, rect, grid, preview, q, limit, resume, resume_size)
 ms_state *ms;
-char *client;
 ms_rectangle rect;
+struct ms_grid *grid;
+struct ms_preview *preview;
+ms_rectangle *q;
+unsigned limit;
+ms_resume_job *resume;
+unsigned resume_size;
 {
 	ms_job j;
 	ms_client_info client_info;
+	char *ext = resume ? (char *)resume : ms->job_ext;
+	unsigned ext_size = resume ? resume_size : ms->job_ext_size;
+	double cost;		/* the most iterations it can take */
+	netcomplex corner, z0, delta;
 	client_info.configuration = ms->configuration;
 	client_info.s = rect;	/* structure assignment */
+	client_info.grid = grid;
+	client_info.preview = preview;
+	client_info.mirror = mirror_of(ms, rect, grid ? (ms_rectangle *)0 : q);
+	client_info.mirror_kx = ms->sym_kx;
+	client_info.mirror_ky = ms->sym_ky;
+	client_info.limit = ms->states ? limit : 0;
+	client_info.resume = (resume != (ms_resume_job *) 0);
+	client_info.packed = !ms->states;
 	/* build a job structure in network byte order */
-	j.j.flags = htons(ms->show_interior ? MS_OPT_INTERIOR : 0);
+	j.j.flags = htons((ms->show_interior ? MS_OPT_INTERIOR : 0) |
+			  (ms->guess && !ms->states ? MS_OPT_GUESS : 0) |
+			  (ms->states ? MS_OPT_STATE : 0) |
+			  (resume ? MS_OPT_RESUME : 0) |
+			  (grid ? MS_OPT_GRID : 0) |
+			  (ms->deep_limbs ? MS_OPT_DEEP : 0) |
+			  (ms->mp_limbs ? MS_OPT_MP : 0) |
+			  (client_info.packed ? MS_OPT_PACK : 0));
+	corner = ms->job.corner;	/* structure assignments */
+	z0 = ms->job.z0;
+	delta = ms->job.delta;
+	if (preview) {
+		/* every step'th pixel, from the corner of the rectangle */
+		netcomplex *origin = ms->job.julia == FRACTAL_JULIA ?
+		    &z0 : &corner;
+		origin->re += preview->x * delta.re;
+		origin->im += preview->y * delta.im;
+		delta.re *= preview->step;
+		delta.im *= preview->step;
+	}
 	j.j.julia = htons(ms->job.julia);
-	j.j.corner.re = htonl(ms->job.corner.re);
-	j.j.corner.im = htonl(ms->job.corner.im);
-	j.j.z0.re = htonl(ms->job.z0.re);
-	j.j.z0.im = htonl(ms->job.z0.im);
-	j.j.delta.re = htonl(ms->job.delta.re);
-	j.j.delta.im = htonl(ms->job.delta.im);
-	j.j.iteration_limit = htonl(ms->job.iteration_limit);
+	j.j.corner.re = htonl(corner.re);
+	j.j.corner.im = htonl(corner.im);
+	j.j.z0.re = htonl(z0.re);
+	j.j.z0.im = htonl(z0.im);
+	j.j.delta.re = htonl(delta.re);
+	j.j.delta.im = htonl(delta.im);
+	j.j.iteration_limit = htonl(limit);
 	j.s.x = htons(rect.x);
 	j.s.width = htons(rect.width);
 	j.s.y = htons(rect.y);
 	j.s.height = htons(rect.height);
+	j.grid_x = htons(grid ? grid->grid_x : 0);
+	j.grid_y = htons(grid ? grid->grid_y : 0);
+	if (resume)
+		cost = ntohs(resume->n_pixels);
+	else if (grid)
+		cost = (double)rect.width * (rect.height / grid->grid_y + 1) +
+		    (double)rect.height * (rect.width / grid->grid_x + 1);
+	else
+		cost = (double)rect.width * rect.height;
+	cost *= limit;
 	/* ..and put it on the work queue */
-	wf_dispatch_chunk(ms->workforce, ms,
-			  (char *)&client_info, sizeof(ms_client_info),
-			  (char *)&j, sizeof(j));
+	if (resume || ms->deep_limbs || ms->mp_limbs) {
+		char buf[sizeof(ms_job) +
+			 MAX(MAX(MS_DEEP_JOB_SIZE(MP_MAX_LIMBS),
+				 MS_MP_JOB_SIZE(MS_MP_MAX_LIMBS)),
+			     MS_RESUME_JOB_SIZE(MS_STATE_MAX_PIXELS))];
+		bcopy((char *)&j, buf, sizeof(j));
+		bcopy(ext, buf + sizeof(j), ext_size);
+		wf_dispatch_chunk(ms->workforce, ms,
+				  (char *)&client_info, sizeof(ms_client_info),
+				  buf, sizeof(j) + ext_size, cost);
+	} else
+		wf_dispatch_chunk(ms->workforce, ms,
+				  (char *)&client_info, sizeof(ms_client_info),
+				  (char *)&j, sizeof(j), cost);
 	ms->chunks_out++;	/* one more to wait for */
 }
 
+static void dispatch(ms, rect, grid, q)
+ms_state *ms;
+ms_rectangle rect;
+struct ms_grid *grid;
+ms_rectangle *q;
+{
+	send_job(ms, rect, grid, (struct ms_preview *)0, q,
+		 ms->states ? ms->pass_limit : ms->job.iteration_limit,
+		 (ms_resume_job *) 0, 0);
+}
+
+void ms_dispatch_chunk(ms, client, rect)
+ms_state *ms;
+char *client;
+ms_rectangle rect;
+{
+	dispatch(ms, rect, (struct ms_grid *)0, (ms_rectangle *)0);
+}
+
 /*
-  Take a rectangular area, split it into pieces and send the pieces
-  out to be calculated.
+  Solid guessing.  Instead of sending out all the chunks of a
+  rectangle, we first ask the servers for the grid lines through it:
+  the borders of the chunks, plus "guess_samples" evenly spaced lines
+  across each chunk for verification.  Since only the lines are
+  calculated, the grids of many chunks fit in a single reply.  When
+  all the grid lines have arrived, each chunk whose border and sample
+  lines all have the same count is filled with that count right here
+  without being sent anywhere, and the rest are sent out as usual.
+
+  The "chunks" here are called tiles, because their size is rounded
+  down to a multiple of the grid spacing.  The border of a tile is
+  taken to be the first row and column of the tile and the first row
+  and column of the tiles to the right and below, so that neighbouring
+  tiles share their borders.
 */
 
-void ms_dispatch_rect(ms, client, rx, ry, rwidth, rheight)
+static void grid_dispatch(ms, rx, ry, rwidth, rheight, q)
+ms_state *ms;
+unsigned rx, ry, rwidth, rheight;
+ms_rectangle *q;
+{
+	struct ms_grid *g = (struct ms_grid *)malloc(sizeof(struct ms_grid));
+	unsigned lines = ms->guess_samples + 1;	/* grid lines per tile */
+	unsigned budget;	/* max. number of counts in a reply */
+	unsigned n;		/* grid blocks are n by n tiles */
+	unsigned bw, bh;	/* grid block size in pixels */
+	unsigned x, y;
+	ms_rectangle r;
+
+	g->configuration = ms->configuration;
+	g->x = rx;
+	g->y = ry;
+	g->width = rwidth;
+	g->height = rheight;
+	g->grid_x = MAX(ms->job_chunk_width / lines, 1);
+	g->grid_y = MAX(ms->job_chunk_height / lines, 1);
+	g->tile_width = MIN(g->grid_x * lines, ms->job_chunk_width);
+	g->tile_height = MIN(g->grid_y * lines, ms->job_chunk_height);
+	g->blocks_out = 0;
+	g->counts = (unsigned short *)
+	    malloc(rwidth * rheight * sizeof(unsigned short));
+	g->has_mirror = (q != (ms_rectangle *)0);
+	if (q)
+		g->mirror = *q;
+
+	/* make the grid blocks as large as will fit in a reply */
+	budget = (MAX_DATAGRAM - sizeof(ReplyHeader) - sizeof(ms_packed)) /
+	    ms->bytes_per_count;
+#define BLOCK_W(n) MIN((n) * g->tile_width + 1, rwidth)
+#define BLOCK_H(n) MIN((n) * g->tile_height + 1, rheight)
+	for (n = 1; BLOCK_W(n) < rwidth || BLOCK_H(n) < rheight; n++)
+		if (MS_GRID_PIXELS(BLOCK_W(n + 1), BLOCK_H(n + 1),
+				   g->grid_x, g->grid_y) > budget)
+			break;
+	bw = n * g->tile_width;
+	bh = n * g->tile_height;
+#undef BLOCK_W
+#undef BLOCK_H
+
+	for (y = 0; y < rheight; y += bh)
+		for (x = 0; x < rwidth; x += bw) {
+			r.x = rx + x;
+			r.y = ry + y;
+			/* the blocks overlap by one pixel, the shared border */
+			r.width = MIN(bw + 1, rwidth - x);
+			r.height = MIN(bh + 1, rheight - y);
+			dispatch(ms, r, g, (ms_rectangle *)0);
+			g->blocks_out++;
+		}
+}
+
+/* Store the counts of a grid reply in the grid. */
+
+static void grid_store(ms, g, s, data)
+ms_state *ms;
+struct ms_grid *g;
+ms_rectangle *s;
+char *data;
+{
+	unsigned x, y;
+	unsigned short *row = g->counts + (s->y - g->y) * g->width
+	    + (s->x - g->x);
+	for (y = 0; y < s->height; y++, row += g->width)
+		for (x = 0; x < s->width; x++)
+			if (MS_ON_GRID(s->height, g->grid_y, y) ||
+			    MS_ON_GRID(s->width, g->grid_x, x)) {
+				if (ms->bytes_per_count == 1) {
+					row[x] = *(uint8 *) data;
+					data += 1;
+				} else {
+					row[x] = ntohs(*(uint16 *) data);
+					data += 2;
+				}
+			}
+}
+
+/*
+  All the grid lines are in; fill in the uniform tiles and send out
+  the rest.
+*/
+
+static void grid_finish(ms, g)
+ms_state *ms;
+struct ms_grid *g;
+{
+	char *fill = (char *)malloc(g->tile_width * g->tile_height *
+				    ms->bytes_per_count);
+	ms_rectangle *q = g->has_mirror ? &g->mirror : (ms_rectangle *)0;
+	ms_client_info client_info;
+	ms_rectangle r;
+	unsigned tx, ty, x, y, x1, y1, i;
+	unsigned short count;
+
+	client_info.configuration = ms->configuration;
+	client_info.grid = (struct ms_grid *)0;
+	client_info.mirror.width = client_info.mirror.height = 0;
+
+	wf_begin_dispatch(ms->workforce);
+	for (ty = 0; ty < g->height; ty += g->tile_height)
+		for (tx = 0; tx < g->width; tx += g->tile_width) {
+			r.x = g->x + tx;
+			r.y = g->y + ty;
+			r.width = MIN(g->tile_width, g->width - tx);
+			r.height = MIN(g->tile_height, g->height - ty);
+
+			/* check the grid lines inside and around the tile */
+			x1 = MIN(tx + g->tile_width, g->width - 1);
+			y1 = MIN(ty + g->tile_height, g->height - 1);
+			count = g->counts[ty * g->width + tx];
+			for (y = ty; y <= y1; y++)
+				for (x = tx; x <= x1; x++)
+					if ((MS_ON_GRID(g->height, g->grid_y, y)
+					     || MS_ON_GRID(g->width, g->grid_x,
+							   x))
+					    && g->counts[y * g->width + x] !=
+					    count)
+						goto mixed;
+
+			/* uniform; draw it as if a server had sent it */
+			for (i = 0; i < r.width * r.height; i++)
+				if (ms->bytes_per_count == 1)
+					((uint8 *) fill)[i] = count;
+				else
+					((uint16 *) fill)[i] = htons(count);
+			client_info.s = r;
+			ms_draw(ms->client, (char *)&client_info, fill);
+			client_info.s = mirror_of(ms, r, q);
+			if (client_info.s.width && client_info.s.height)
+				ms_draw(ms->client, (char *)&client_info,
+					fill);
+			continue;
+ mixed:
+			dispatch(ms, r, (struct ms_grid *)0, q);
+		}
+	wf_restart(ms->workforce);
+	free(fill);
+}
+
+/*
+  Chunks with packed replies are sent out in blocks of up to MS_MERGE
+  by MS_MERGE chunks, as large as a packed reply can be.  The
+  workforce has a block split (see wf_split() below) before sending
+  it to a server that would take long over it, so a fast server gets
+  whole blocks and a slow one single chunks.  The client's ms_draw()
+  must therefore take a whole block.
+*/
+
+/*
+  Split a rectangular area into blocks of chunks and send them out.
+  "q" is the area to fill by reflection.
+*/
+
+static void dispatch_blocks(ms, rx, ry, rwidth, rheight, q)
 ms_state *ms;
-char *client;
 unsigned rx, ry, rwidth, rheight;
+ms_rectangle *q;
 {
 	ms_rectangle r;
 	unsigned int right_edge = rx + rwidth;
 	unsigned int bottom_edge = ry + rheight;
-	unsigned int x, y;
+	unsigned int x, y, k;
+	unsigned int bw = ms->job_chunk_width, bh = ms->job_chunk_height;
 
-	wf_begin_dispatch(ms->workforce);
+	if (!ms->states)
+		for (k = MS_MERGE; k > 1; k /= 2)
+			if (k * bw <= MS_PACK_MAX_ROW &&
+			    k * bw * k * bh <= MS_PACK_MAX_PIXELS) {
+				bw *= k;
+				bh *= k;
+				break;
+			}
 
-	for (y = ry; y < bottom_edge; y += ms->chunk_height)
-		for (x = rx; x < right_edge; x += ms->chunk_width) {
+	for (y = ry; y < bottom_edge; y += bh)
+		for (x = rx; x < right_edge; x += bw) {
 			r.x = x;
 			r.y = y;
-			r.width = MIN(ms->chunk_width, right_edge - x);
-			r.height = MIN(ms->chunk_height, bottom_edge - y);
-			ms_dispatch_chunk(ms, client, r);
+			r.width = MIN(bw, right_edge - x);
+			r.height = MIN(bh, bottom_edge - y);
+			dispatch(ms, r, (struct ms_grid *)0, q);
+		}
+}
+
+/*
+  Cost balancing.  The chunks of a picture differ wildly in cost:
+  those near the boundary of the set can take a hundred times longer
+  than those far outside it, and the last of them then holds up the
+  whole picture.  So the picture is first calculated at a coarse
+  spacing, a preview of some thousand samples costing a few percent
+  of the whole, and the count of each sample is taken as the cost of
+  the pixels around it.  The area is then cut in two along chunk
+  boundaries where it halves the predicted cost, again and again
+  until each piece is predicted to cost at most the average chunk, or
+  is a single chunk; cheap areas are thus sent out in large pieces and
+  costly ones in small ones.  A piece is also never more than MS_MERGE
+  by MS_MERGE chunks, however cheap: a fast server gets it whole, and
+  ms_draw() can take no more than that.  The most costly pieces are
+  sent out first, so that the cheap ones fill in the gaps at the end.
+  The preview itself is one job, no wider or taller than a packed
+  reply allows.
+*/
+#define PREVIEW_MIN_STEP 4	/* the preview costs at most 1/16 */
+
+struct ms_piece {
+	ms_rectangle r;
+	double cost;		/* predicted */
+};
+
+static void preview_dispatch(ms, rx, ry, rwidth, rheight, q)
+ms_state *ms;
+unsigned rx, ry, rwidth, rheight;
+ms_rectangle *q;
+{
+	struct ms_preview *p =
+	    (struct ms_preview *)malloc(sizeof(struct ms_preview));
+	unsigned budget = (MAX_DATAGRAM - sizeof(ReplyHeader) -
+			   sizeof(ms_packed)) / ms->bytes_per_count;
+	ms_rectangle r;
+
+	p->configuration = ms->configuration;
+	p->x = rx;
+	p->y = ry;
+	p->width = rwidth;
+	p->height = rheight;
+	for (p->step = PREVIEW_MIN_STEP;; p->step++) {
+		p->nx = (rwidth + p->step - 1) / p->step;
+		p->ny = (rheight + p->step - 1) / p->step;
+		if (p->nx * p->ny <= budget && p->nx <= MS_PACK_MAX_ROW &&
+		    p->ny <= MS_PACK_MAX_ROW)
+			break;
+	}
+	p->sums = (double *)0;
+	p->has_mirror = (q != (ms_rectangle *)0);
+	if (q)
+		p->mirror = *q;
+	r.x = r.y = 0;
+	r.width = p->nx;
+	r.height = p->ny;
+	send_job(ms, r, (struct ms_grid *)0, p, (ms_rectangle *)0,
+		 ms->job.iteration_limit, (ms_resume_job *) 0, 0);
+}
+
+/* The predicted cost of the pixels above and left of (x, y) in "p" */
+
+static double preview_sum(p, x, y)
+struct ms_preview *p;
+unsigned x, y;
+{
+	double u = MIN((double)x / p->step, (double)p->nx);
+	double v = MIN((double)y / p->step, (double)p->ny);
+	unsigned i = MIN((unsigned)u, p->nx - 1);
+	unsigned j = MIN((unsigned)v, p->ny - 1);
+	double *s = p->sums + j * (p->nx + 1) + i;
+	u -= i;
+	v -= j;
+	/* the cost is even across each sample, so interpolate the sums */
+	return ((1 - v) * ((1 - u) * s[0] + u * s[1]) +
+		v * ((1 - u) * s[p->nx + 1] + u * s[p->nx + 2]));
+}
+
+/* The predicted cost of "r" */
+
+static double preview_cost(p, r)
+struct ms_preview *p;
+ms_rectangle *r;
+{
+	unsigned x0 = r->x - p->x, y0 = r->y - p->y;
+	unsigned x1 = x0 + r->width, y1 = y0 + r->height;
+	return (preview_sum(p, x1, y1) - preview_sum(p, x0, y1) -
+		preview_sum(p, x1, y0) + preview_sum(p, x0, y0));
+}
+
+/* Cut "r" into pieces of at most "target" predicted cost */
+
+static void partition(ms, p, r, target, pieces, n)
+ms_state *ms;
+struct ms_preview *p;
+ms_rectangle r;
+double target;
+struct ms_piece *pieces;
+unsigned *n;
+{
+	unsigned cw = ms->job_chunk_width, ch = ms->job_chunk_height;
+	unsigned cols = (r.width + cw - 1) / cw;
+	unsigned rows = (r.height + ch - 1) / ch;
+	double cost = preview_cost(p, &r), d, best_d = -1;
+	ms_rectangle a, b;
+	unsigned k, best = 1;
+	int across;		/* cut across the rows */
+
+	if ((cols > 1 || rows > 1) &&
+	    (cost > target || cols > MS_MERGE || rows > MS_MERGE ||
+	     r.width > MS_PACK_MAX_ROW ||
+	     r.width * r.height > MS_PACK_MAX_PIXELS)) {
+		across = (r.height > r.width && rows > 1) || cols == 1;
+		a = r;		/* structure assignment */
+		for (k = 1; k < (across ? rows : cols); k++) {
+			if (across)
+				a.height = k * ch;
+			else
+				a.width = k * cw;
+			d = preview_cost(p, &a) - cost / 2;
+			if (d < 0)
+				d = -d;
+			if (best_d < 0 || d < best_d) {
+				best_d = d;
+				best = k;
+			}
+		}
+		a = b = r;
+		if (across) {
+			a.height = best * ch;
+			b.y += a.height;
+			b.height -= a.height;
+		} else {
+			a.width = best * cw;
+			b.x += a.width;
+			b.width -= a.width;
+		}
+		partition(ms, p, a, target, pieces, n);
+		partition(ms, p, b, target, pieces, n);
+		return;
+	}
+	pieces[*n].r = r;	/* structure assignment */
+	pieces[*n].cost = cost;
+	(*n)++;
+}
+
+static int by_cost(a, b)
+struct ms_piece *a, *b;
+{
+	return (a->cost < b->cost ? 1 : a->cost > b->cost ? -1 : 0);
+}
+
+/*
+  The preview has arrived with the counts "data"; send out the area
+  in pieces of even predicted cost.  If "data" is null, the preview
+  didn't fit in a reply, and the area is sent out as usual.
+*/
+
+static void preview_finish(ms, p, data)
+ms_state *ms;
+struct ms_preview *p;
+char *data;
+{
+	ms_rectangle *q = p->has_mirror ? &p->mirror : (ms_rectangle *)0;
+	unsigned cw = ms->job_chunk_width, ch = ms->job_chunk_height;
+	unsigned w = p->nx + 1, i, j, n = 0;
+	double row, target;
+	struct ms_piece *pieces;
+	ms_rectangle r;
+
+	wf_begin_dispatch(ms->workforce);
+	if (!data) {
+		dispatch_blocks(ms, p->x, p->y, p->width, p->height, q);
+		wf_restart(ms->workforce);
+		return;
+	}
+	p->sums = (double *)malloc(w * (p->ny + 1) * sizeof(double));
+	for (i = 0; i < w; i++)
+		p->sums[i] = 0;
+	for (j = 0; j < p->ny; j++) {
+		p->sums[(j + 1) * w] = row = 0;
+		for (i = 0; i < p->nx; i++) {
+			row += 1 + (ms->bytes_per_count == 1 ?
+				    ((uint8 *) data)[j * p->nx + i] :
+				    ntohs(((uint16 *) data)[j * p->nx + i]));
+			p->sums[(j + 1) * w + i + 1] =
+			    p->sums[j * w + i + 1] + row;
+		}
+	}
+
+	/* no piece to cost more than the average chunk */
+	i = ((p->width + cw - 1) / cw) * ((p->height + ch - 1) / ch);
+	target = p->sums[w * (p->ny + 1) - 1] / MAX(i, 1);
+	pieces = (struct ms_piece *)malloc(i * sizeof(struct ms_piece));
+	r.x = p->x;
+	r.y = p->y;
+	r.width = p->width;
+	r.height = p->height;
+	partition(ms, p, r, target, pieces, &n);
+	qsort((char *)pieces, n, sizeof(struct ms_piece), by_cost);
+	for (i = 0; i < n; i++)
+		dispatch(ms, pieces[i].r, (struct ms_grid *)0, q);
+	wf_restart(ms->workforce);
+	free((char *)pieces);
+}
+
+/*
+  Split a rectangular area into chunks and send them out, or their
+  grid lines if solid guessing, or a preview if balancing the cost.
+  "q" is the area to fill by reflection.
+*/
+
+static void dispatch_part(ms, rx, ry, rwidth, rheight, q)
+ms_state *ms;
+unsigned rx, ry, rwidth, rheight;
+ms_rectangle *q;
+{
+	if (rwidth == 0 || rheight == 0)
+		return;
+
+	if (ms->solid_guess && !ms->states) {
+		grid_dispatch(ms, rx, ry, rwidth, rheight, q);
+		return;
+	}
+
+	if (ms->balance && !ms->states && !ms->deep_limbs && !ms->mp_limbs &&
+	    (rwidth > PREVIEW_MIN_STEP * ms->job_chunk_width ||
+	     rheight > PREVIEW_MIN_STEP * ms->job_chunk_height)) {
+		preview_dispatch(ms, rx, ry, rwidth, rheight, q);
+		return;
+	}
+
+	dispatch_blocks(ms, rx, ry, rwidth, rheight, q);
+}
+
+/*
+  Take a rectangular area, split it into pieces and send the pieces
+  out to be calculated.  If part of the area is the mirror image of
+  another part, only the rest is sent out; the mirrored part is
+  filled in as the chunks it mirrors arrive.
+*/
+
+void ms_dispatch_rect(ms, client, rx, ry, rwidth, rheight)
+ms_state *ms;
+char *client;
+unsigned rx, ry, rwidth, rheight;
+{
+	ms_rectangle q;
+
+	wf_begin_dispatch(ms->workforce);
+	if (mirror_part(ms, rx, ry, rwidth, rheight, &q)) {
+		/* above, below, left of and right of the mirrored part */
+		dispatch_part(ms, rx, ry, rwidth, q.y - ry, &q);
+		dispatch_part(ms, rx, q.y + q.height, rwidth,
+			      ry + rheight - (q.y + q.height), &q);
+		dispatch_part(ms, rx, q.y, q.x - rx, q.height, &q);
+		dispatch_part(ms, q.x + q.width, q.y,
+			      rx + rwidth - (q.x + q.width), q.height, &q);
+	} else
+		dispatch_part(ms, rx, ry, rwidth, rheight, (ms_rectangle *)0);
+	wf_restart(ms->workforce);
+}
+
+/*
+  The pixels still to be continued: those with a state that are not
+  known to be inside.  A pixel whose "iterations" is zero has no
+  state; it has escaped.  RESUMABLE() is true of those that can be
+  continued to "limit".
+*/
+
+#define PENDING(ms, p) ((ms)->states[p].iterations != 0 && \
+			(ms)->states[p].iterations != htonl(MS_STATE_INSIDE))
+#define RESUMABLE(ms, p, limit) (PENDING(ms, p) && \
+			ntohl((ms)->states[p].iterations) < (limit) - 1)
+
+/*
+  Draw the chunk info->s from the stored counts.  "buf" must have room
+  for the counts of a chunk.
+*/
+
+static void draw_counts(ms, info, buf)
+ms_state *ms;
+ms_client_info *info;
+char *buf;
+{
+	ms_rectangle *r = &info->s;
+	unsigned x, y, p, i = 0;
+	unsigned short count;
+	for (y = 0; y < r->height; y++)
+		for (x = 0; x < r->width; x++, i++) {
+			p = (r->y + y) * ms->width + r->x + x;
+			count = ms->states[p].iterations ?
+			    ms->job.iteration_limit - 1 : ms->counts[p];
+			if (ms->bytes_per_count == 1)
+				((uint8 *) buf)[i] = count;
+			else
+				((uint16 *) buf)[i] = htons(count);
+		}
+	ms_draw(ms->client, (char *)info, buf);
+}
+
+/*
+  Store the counts and states of a reply to an MS_OPT_STATE job.  The
+  counts come in the size for the limit of the job, which need not
+  be the size used for drawing.  Of a resumed chunk, only the pixels
+  that were sent out are taken.
+*/
+
+static void state_store(ms, info, data)
+ms_state *ms;
+ms_client_info *info;
+char *data;
+{
+	ms_rectangle *r = &info->s;
+	unsigned bpc = info->limit > 256 ? 2 : 1;
+	ms_pixel_state *sp = (ms_pixel_state *)
+	    (data + MS_STATE_OFFSET(r->width * r->height, bpc));
+	unsigned x, y, p, i = 0;
+	unsigned short count;
+	for (y = 0; y < r->height; y++)
+		for (x = 0; x < r->width; x++, i++) {
+			p = (r->y + y) * ms->width + r->x + x;
+			if (info->resume && !RESUMABLE(ms, p, info->limit))
+				continue;
+			if (bpc == 1)
+				count = ((uint8 *) data)[i];
+			else
+				count = ntohs(((uint16 *) data)[i]);
+			if (count == info->limit - 1) {
+				ms->states[p] = *sp++;	/* structure assignment */
+			} else {
+				ms->counts[p] = count;
+				ms->states[p].iterations = 0;
+			}
+		}
+}
+
+/*
+  Send out the pixels of chunk "r" that can be continued to "limit",
+  if there are any.  Returns the number of chunks sent out.
+*/
+
+static int resume_chunk(ms, r, limit)
+ms_state *ms;
+ms_rectangle r;
+unsigned limit;
+{
+	char buf[MS_RESUME_JOB_SIZE(MS_STATE_MAX_PIXELS)];
+	ms_resume_job *rj = (ms_resume_job *) buf;
+	unsigned x, y, p, n = 0;
+	for (y = 0; y < r.height; y++)
+		for (x = 0; x < r.width; x++) {
+			p = (r.y + y) * ms->width + r.x + x;
+			if (!RESUMABLE(ms, p, limit))
+				continue;
+			rj->pixels[n].index = htons(y * r.width + x);
+			rj->pixels[n].pad = 0;
+			rj->pixels[n].state = ms->states[p];	/* structure assignment */
+			n++;
+		}
+	if (n == 0)
+		return (0);
+	rj->n_pixels = htons(n);
+	rj->pad = 0;
+	send_job(ms, r, (struct ms_grid *)0, (struct ms_preview *)0,
+		 (ms_rectangle *)0, limit, rj,
+		 MS_RESUME_JOB_SIZE(n));
+	return (1);
+}
+
+/* the chunk of the picture that a pixel is in, counting row by row */
+
+#define CHUNK_NO(ms, nx, x, y) \
+	((y) / (ms)->job_chunk_height * (nx) + (x) / (ms)->job_chunk_width)
+
+/*
+  Choose the limit of each chunk for the next pass.  The escape
+  counts near the edge of the set grow without bound, so if a chunk
+  or one of its neighbours has pixels escaping in the latter half of
+  the chunk's limit, its remaining pixels are likely to escape too
+  with more iterations, and the chunk is continued to four times its
+  limit, or four times the latest escape nearby if that is more.
+  Otherwise they are taken to be inside.  If nothing at all has
+  escaped yet, every chunk is continued.  Returns the number of
+  chunks sent out, which is zero when the picture is finished.
+*/
+
+static int auto_deepen(ms)
+ms_state *ms;
+{
+	unsigned nx = (ms->width + ms->job_chunk_width - 1) /
+	    ms->job_chunk_width;
+	unsigned ny = (ms->height + ms->job_chunk_height - 1) /
+	    ms->job_chunk_height;
+	unsigned *escape = (unsigned *)malloc(nx * ny * sizeof(unsigned));
+	unsigned *reached = (unsigned *)malloc(nx * ny * sizeof(unsigned));
+	unsigned x, y, p, c, e, limit;
+	int cx, cy, any_escaped = 0;
+	int n = 0;
+	ms_rectangle r;
+
+	/* the latest escape and the limit reached in each chunk */
+	for (c = 0; c < nx * ny; c++)
+		escape[c] = reached[c] = 0;
+	for (y = 0; y < ms->height; y++)
+		for (x = 0; x < ms->width; x++) {
+			p = y * ms->width + x;
+			c = CHUNK_NO(ms, nx, x, y);
+			if (PENDING(ms, p)) {
+				limit = ntohl(ms->states[p].iterations) + 1;
+				reached[c] = MAX(reached[c], limit);
+			} else if (!ms->states[p].iterations) {
+				escape[c] = MAX(escape[c], ms->counts[p]);
+				any_escaped = 1;
+			}
+		}
+
+	wf_begin_dispatch(ms->workforce);
+	for (r.y = 0; r.y < ms->height; r.y += ms->job_chunk_height)
+		for (r.x = 0; r.x < ms->width; r.x += ms->job_chunk_width) {
+			c = CHUNK_NO(ms, nx, r.x, r.y);
+			if (!reached[c] || reached[c] >= ms->job.iteration_limit)
+				continue;
+			e = 0;
+			for (cy = (int)(c / nx) - 1; cy <= (int)(c / nx) + 1;
+			     cy++)
+				for (cx = (int)(c % nx) - 1;
+				     cx <= (int)(c % nx) + 1; cx++)
+					if (cy >= 0 && cy < ny && cx >= 0 &&
+					    cx < nx)
+						e = MAX(e, escape[cy * nx + cx]);
+			if (any_escaped && 2 * e < reached[c])
+				continue;
+			limit = MIN(4 * MAX(reached[c], e),
+				    ms->job.iteration_limit);
+			r.width = MIN(ms->job_chunk_width, ms->width - r.x);
+			r.height = MIN(ms->job_chunk_height, ms->height - r.y);
+			n += resume_chunk(ms, r, limit);
 		}
 	wf_restart(ms->workforce);
+	free((char *)escape);
+	free((char *)reached);
+	return (n);
+}
+
+/*
+  The counts of a packed reply (see MS_OPT_PACK in ms_job.h) to the
+  chunk described by "info": either in the reply itself, or unpacked
+  into a buffer that is returned in *bufp to be freed.  Returns a null
+  pointer if the server says the chunk is too large.
+*/
+
+static char *unpack(ms, info, data, bufp)
+ms_state *ms;
+ms_client_info *info;
+char *data;
+char **bufp;
+{
+	ms_packed *h = (ms_packed *) data;
+	uint8 *p = (uint8 *) (h + 1), *end;
+	unsigned bpc = ms->bytes_per_count;
+	unsigned mask = (bpc == 1) ? 0xFF : 0xFFFF;
+	unsigned n, i = 0, k, u, shift, prev = 0;
+	char *buf;
+
+	*bufp = (char *)0;
+	switch (ntohs(h->encoding)) {
+	case MS_PACK_RAW:
+		return ((char *)p);
+	case MS_PACK_UNIFORM:
+		prev = ntohs(h->value) & mask;
+		end = p;
+		break;
+	case MS_PACK_RUNS:
+		end = p + ntohs(h->value);
+		break;
+	default:		/* MS_PACK_SPLIT */
+		return ((char *)0);
+	}
+	n = info->grid ? MS_GRID_PIXELS(info->s.width, info->s.height,
+					info->grid->grid_x,
+					info->grid->grid_y) :
+	    info->s.width * info->s.height;
+	buf = *bufp = (char *)malloc(MAX(n, 1) * bpc);
+#define PUT(c) (bpc == 1 ? (((uint8 *) buf)[i++] = (c)) : \
+		(((uint16 *) buf)[i++] = htons(c)))
+	while (i < n && p < end) {
+		k = *p++;
+		if (k < 0x80) {		/* a run */
+			for (k++; k > 0 && i < n; k--)
+				PUT(prev);
+			continue;
+		}
+		for (k = (k & 0x7F) + 1; k > 0 && i < n; k--) {
+			for (u = shift = 0; p < end && shift < 32; shift += 7) {
+				u |= (unsigned)(*p & 0x7F) << shift;
+				if (!(*p++ & 0x80))
+					break;
+			}
+			prev = (prev + ((u & 1) ? -(int)(u >> 1) - 1 :
+					(int)(u >> 1))) & mask;
+			PUT(prev);
+		}
+	}
+	while (i < n)		/* all of a uniform chunk */
+		PUT(prev);
+#undef PUT
+	return (buf);
+}
+
+/*
+  Send out the chunk described by "info" again in two halves, after
+  it proved too large for a reply or too much for a server.
+*/
+
+static void split_chunk(ms, info)
+ms_state *ms;
+ms_client_info *info;
+{
+	ms_rectangle a, b;
+	ms_rectangle *q = (info->mirror.width && info->mirror.height) ?
+	    &info->mirror : (ms_rectangle *)0;
+
+	a = b = info->s;	/* structure assignment */
+	if (a.width >= a.height) {
+		a.width /= 2;
+		b.x += a.width;
+		b.width -= a.width;
+	} else {
+		a.height /= 2;
+		b.y += a.height;
+		b.height -= a.height;
+	}
+	dispatch(ms, a, (struct ms_grid *)0, q);
+	dispatch(ms, b, (struct ms_grid *)0, q);
+}
+
+/*
+  Called by the workforce for a chunk that a server would take long
+  over.  The blocks of dispatch_part() are split down to the chunk
+  size.
+*/
+
+int wf_split(client, client_data)
+char *client;
+char *client_data;
+{
+	ms_state *ms = (ms_state *) client;
+	ms_client_info *info = (ms_client_info *) client_data;
+	if (!info->packed || info->grid || info->preview ||
+	    info->configuration != ms->configuration ||
+	    (info->s.width <= ms->job_chunk_width &&
+	     info->s.height <= ms->job_chunk_height))
+		return (0);
+	split_chunk(ms, info);
+	ms->chunks_out--;	/* the pieces take its place */
+	return (1);
 }
 
 void wf_draw(client, client_data, data)
@@ -126,12 +1375,97 @@ char *client_data;
 char *data;
 {
 	ms_state *ms = (ms_state *) client;
-	ms_draw(ms->client, client_data, data);
+	ms_client_info *the_info = (ms_client_info *) client_data;
+	struct ms_grid *g = the_info->grid;
+	struct ms_preview *p = the_info->preview;
+	char *buf = (char *)0;
+	if (!data) {
+		/* cancelled; just keep count */
+		if (g && --g->blocks_out == 0) {
+			free((char *)g->counts);
+			free((char *)g);
+		}
+		if (p)
+			free((char *)p);
+		if (--ms->chunks_out == 0)
+			wf_done(ms->workforce);
+		return;
+	}
+	if (p) {
+		/* a preview; ignore it if the configuration has changed */
+		if (p->configuration == ms->configuration)
+			preview_finish(ms, p, unpack(ms, the_info, data, &buf));
+		if (p->sums)
+			free((char *)p->sums);
+		free((char *)p);
+	} else if (the_info->packed &&
+		   !(data = unpack(ms, the_info, data, &buf))) {
+		/* too large for a datagram; ask for it in pieces */
+		if (the_info->configuration == ms->configuration &&
+		    the_info->s.width * the_info->s.height > 1) {
+			wf_begin_dispatch(ms->workforce);
+			split_chunk(ms, the_info);
+			wf_restart(ms->workforce);
+		}
+	} else if (g) {
+		/* a grid reply; ignore it if the configuration has changed */
+		int current = (g->configuration == ms->configuration);
+		if (current)
+			grid_store(ms, g, &the_info->s, data);
+		if (--g->blocks_out == 0) {
+			if (current)
+				grid_finish(ms, g);
+			free((char *)g->counts);
+			free((char *)g);
+		}
+	} else if (the_info->limit) {
+		/* a state chunk; draw it from the stored counts */
+		if (the_info->configuration == ms->configuration) {
+			char buf[MS_STATE_MAX_PIXELS * sizeof(uint16)];
+			state_store(ms, the_info, data);
+			draw_counts(ms, the_info, buf);
+		}
+	} else {
+		if (the_info->mirror.width && the_info->mirror.height)
+			reflect(ms, the_info, data);
+		ms_draw(ms->client, client_data, data);
+	}
+	if (buf)
+		free(buf);
 	ms->chunks_out--;	/* one less to go */
-	if (ms->chunks_out == 0)
+	if (ms->chunks_out == 0 &&
+	    !(ms->auto_iterations && ms->states && auto_deepen(ms)))
 		wf_done(ms->workforce);	/* tell the lower layers that we are done */
 }
 
+/*
+  Continue the pixels that reached the limit of an earlier pass to
+  "limit", at most the iteration limit of the picture, sending them
+  out chunk by chunk.  Returns the number of chunks sent out, which
+  is zero if there is nothing to continue or the pixel states were
+  not kept.
+*/
+
+int ms_deepen(ms, limit)
+ms_state *ms;
+unsigned limit;
+{
+	ms_rectangle r;
+	int n = 0;
+	if (!ms->states)
+		return (0);
+	limit = MIN(limit, ms->job.iteration_limit);
+	wf_begin_dispatch(ms->workforce);
+	for (r.y = 0; r.y < ms->height; r.y += ms->job_chunk_height)
+		for (r.x = 0; r.x < ms->width; r.x += ms->job_chunk_width) {
+			r.width = MIN(ms->job_chunk_width, ms->width - r.x);
+			r.height = MIN(ms->job_chunk_height, ms->height - r.y);
+			n += resume_chunk(ms, r, limit);
+		}
+	wf_restart(ms->workforce);
+	return (n);
+}
+
 ms_main(ms)
 ms_state *ms;
 {
@@ -5,6 +5,16 @@
 
 #include "ms_job.h"		/* for struct static_job_info, etc. */
 #include "ms_real.h"		/* for "complex" declaration */
+#include "mpfix.h"		/* for deep zoom coordinates */
+
+/* room for a coordinate printed by ms_coordinate_text() */
+#define MS_COORD_TEXT_SIZE	320
+
+/*
+  Packed chunks are sent out in blocks of up to MS_MERGE by MS_MERGE
+  chunks, so ms_draw() may be given a rectangle that large.
+*/
+#define MS_MERGE	4
 
 /*
   We must #undef at least the old ABS definition because
@@ -30,17 +40,26 @@
 typedef struct {
 	unsigned int configuration;	/* used to check for obsolete replies */
 	ms_rectangle s;		/* rectangle being updated */
+	struct ms_grid *grid;	/* solid guessing grid, if the chunk is one */
+	struct ms_preview *preview;	/* cost preview, if the chunk is one */
+	ms_rectangle mirror;	/* area to fill by reflecting this chunk */
+	int mirror_kx;		/* x + x' of mirrored pixels, or -1 if no flip */
+	int mirror_ky;		/* y + y' of mirrored pixels */
+	unsigned limit;		/* iteration limit of a state chunk, or 0 */
+	int resume;		/* flag: the chunk continues pending pixels */
+	int packed;		/* flag: the reply is packed (MS_OPT_PACK) */
 } ms_client_info;
 
 typedef struct ms_state {
 	char *client;		/* back pointer to client object (Ms/bms) */
 	unsigned height;
 	unsigned width;
-	double center_x;	/* x coord. of view center */
-	double center_y;	/* y coord. of view center */
+	mpfix center_re;	/* x coord. of view center, to full precision */
+	mpfix center_im;	/* y coord. of view center */
 	double xrange;		/* real axis interval */
 	double yrange;		/* imaginary axis interval */
 	int julia;		/* Julia set mode (used as a Bool by Ms.c) */
+	int fractal;		/* FRACTAL_xxx type when not in Julia mode */
 	double c_x;		/* c value for Julia set only, real part */
 	double c_y;		/*   imaginary part */
 	unsigned long mi_count;	/* total no. of iterations done */
@@ -50,13 +69,36 @@ typedef struct ms_state {
 	unsigned configuration;	/* serial no. of current setup */
 	unsigned chunk_height;	/* height of pixel block */
 	unsigned chunk_width;	/* width of pixel block */
+	unsigned job_chunk_height;	/* those of this picture, within the */
+	unsigned job_chunk_width;	/*   limits of the job */
 	struct wf_state *workforce;	/* pointer to workforce data */
 	int show_interior;	/* flag: display interior structure */
+	int guess;		/* flag: let the servers guess uniform areas */
+	int solid_guess;	/* flag: fill uniform chunks without sending them */
+	unsigned guess_samples;	/* extra grid lines checked per chunk */
+	int symmetry;		/* flag: calculate mirrored areas only once */
+	int balance;		/* flag: split the picture by predicted cost */
+	int sym_kx, sym_ky;	/* axes of symmetry (see mspawn.c) */
+	int deep;		/* flag: deep zoom even when not needed */
+	int exact;		/* flag: deep zoom without perturbation */
+	unsigned deep_limbs;	/* precision of a deep zoom job, or 0 */
+	unsigned mp_limbs;	/* precision of a multiple-precision job, or 0 */
+	char *job_ext;		/* what follows the ms_job in those */
+	unsigned job_ext_size;
+	int keep_state;		/* flag: keep pixel states for ms_deepen() */
+	int auto_iterations;	/* flag: choose the limit of each chunk */
+	unsigned first_limit;	/* iteration limit of the first pass, or 0 */
+	unsigned pass_limit;	/* that of this picture's first pass */
+	unsigned short *counts;	/* the counts of the picture, if kept */
+	ms_pixel_state *states;	/* the states of the pixels at their limit */
 } ms_state;
 
 void ms_init();
+void ms_set_center();
+char *ms_coordinate_text();
 void ms_calculate_job_parameters();
 void ms_dispatch_chunk();
 void ms_dispatch_rect();
+int ms_deepen();
 
 #endif				/* _mspawn_h */
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>		/* pre-X11R4 systems need this for EWOULDBLOCK */
+#include <sys/time.h>
 
 #ifdef NO_STRDUP
 char *strdup();
@@ -63,8 +64,15 @@ typedef struct slave {
 	NET_ADDRESS name;	/* network address of the slave */
 	int has_timeout;	/* the timeout has been initialized */
 	unsigned timeout;	/* timeout in milliseconds */
+	unsigned first_timeout;	/* the timeout until there is an estimate */
+	int has_estimate;	/* "rate" and "rate_dev" are valid */
+	double rate;		/* smoothed milliseconds per unit of cost */
+	double rate_dev;	/* and their mean deviation */
+	unsigned int backoff;	/* timeouts since the last estimate */
+	long busy_since;	/* when it started on its current chunk */
 #ifndef OLD_TIMEOUT
-	long timeout_at;	/* when to timeout (seconds since epoc) */
+	long timeout_at;	/* when to timeout (see wf_now()) */
+	unsigned int due_index;	/* where in wf->due the slave is */
 #else
 	char *timer_id;		/* timeout id (for removing the timeout) */
 #endif
@@ -75,8 +83,47 @@ typedef struct slave {
 	unsigned int no;	/* slave serial number */
 	struct wf_state *backptr;	/* back pointer to the wf_state */
 	int disabled;		/* slave disabled due to error */
+	unsigned int in_flight;	/* chunks sent and not yet replied to */
+	unsigned int window;	/* how many the slave wants in flight */
 } slave;
 
+/*
+  The messages to the slaves are not sent at once but collected, up
+  to MAX_OUT of them or OUT_BYTES in all, and sent together by
+  flush_messages() when the workforce is through with whatever made
+  it send them (see io_send_batch()).
+*/
+#define MAX_OUT 64
+#define OUT_BYTES (4 * MAX_DATAGRAM)
+
+/*
+  The timeout of a slave is estimated the way TCP estimates its
+  retransmission timeout (RFC 6298), except that what is smoothed is
+  not the time a reply takes but that time divided by the cost of the
+  chunk, so that a slave can be given a short timeout for a small
+  chunk and a long one for a big one.  The time a reply takes is
+  counted from when the slave could start on the chunk, that is, from
+  the previous reply if it had more chunks in flight.  As in TCP,
+  replies to chunks that have been sent more than once are not
+  counted, and the timeout is doubled each time it runs out until a
+  reply is counted again.  The timeout given to wf_init() is used
+  until the first reply.
+*/
+#define MIN_TIMEOUT	100	/* milliseconds */
+#define MAX_TIMEOUT	600000
+#define MAX_BACKOFF	6
+
+/*
+  The same estimate decides how big a piece of work a slave gets: a
+  chunk that it would likely take more than SPLIT_TIME milliseconds
+  over is split by the client (see wf_split() in work.h) before it is
+  sent, and so is any chunk for a slave that has not replied yet, so
+  that its first reply comes soon.  A fast slave thus gets the chunks
+  as they were dispatched, and a slow one smaller pieces that won't
+  hold up the end of the sequence.
+*/
+#define SPLIT_TIME	20
+
 typedef struct chunk {
 	struct chunk *next;
 	struct chunk *prev;
@@ -86,24 +133,73 @@ typedef struct chunk {
 	char *client_data;	/* client data (unknown size) */
 	char *slave_data;	/* slave data */
 	unsigned int slave_datalen;	/* length of slave data */
+	int sent_to;		/* the slave it was last sent to, or -1 */
+	unsigned int n_sent;	/* how many times it has been sent */
+	double cost;		/* the most work it can take; see work.h */
 } chunk;
 
+/*
+  The chunks of a sequence are allocated together with their client
+  and slave data from an arena: a list of blocks of ARENA_BLOCK bytes
+  (or more, for a chunk that doesn't fit in one) that are filled one
+  after the other and all reused at once when the sequence ends.  The
+  blocks are kept from one sequence to the next, so a workforce that
+  keeps drawing pictures of about the same size doesn't allocate
+  anything.  The arena also holds the index that finds a chunk by its
+  number.
+*/
+#define ARENA_BLOCK 65536
+
+typedef struct block {
+	struct block *next;
+	unsigned int size;	/* bytes of space following the header */
+} block;
+
+/* the strictest alignment needed by anything in a chunk's data */
+typedef union {
+	double d;
+	long l;
+	char *p;
+} arena_align;
+
+#define ARENA_ROUND(n) (((n) + sizeof(arena_align) - 1) / \
+	sizeof(arena_align) * sizeof(arena_align))
+#define BLOCK_SPACE(b) ((char *)(b) + ARENA_ROUND(sizeof(block)))
+
+typedef struct arena {
+	block *first;		/* the blocks, in the order they are used */
+	block *current;		/* the one being filled, or null */
+	unsigned int used;	/* bytes of it in use */
+	int n_chunks;		/* number of chunks in the active sequence */
+	unsigned int max_chunks;	/* current size of chunk index */
+	struct chunk **index;	/* the chunks by number */
+} arena;
+
 struct wf_state {
 	io_state *io;		/* pointer to I/O object */
 	int sequence;		/* current sequence number */
 	int pid;		/* pid of this process */
 	unsigned n_slaves;	/* number of slaves */
 	struct slave **slaves;	/* array of pointers to slave descriptors */
-	int n_chunks;		/* number of chunks in the active sequence */
-	unsigned int max_chunks;	/* current size of chunk index */
-	struct chunk **chunks;	/* pointer to the chunk index */
+	arena chunks;		/* the chunks of the active sequence */
 	struct chunk to_draw;	/* head of queue of chunks to be drawn */
 	struct chunk drawn;	/* head of queue of chunks already drawn */
 	struct chunk *insert_point;	/* point in queue for inserting new work */
+	unsigned long n_prec[N_PREC];	/* replies by arithmetic used */
+	int can_abort;		/* the slaves understand abort messages */
+	io_message out[MAX_OUT];	/* messages waiting to be sent */
+	struct slave *out_slave[MAX_OUT];	/* whom they are for */
+	int n_out;
+	char *out_buf;		/* holds their contents */
+	unsigned int out_len;
+	struct slave **due;	/* the slaves with timeouts, soonest first */
+	unsigned int n_due;
+	long timer_at;		/* when the I/O module will tick, or -1 */
 };
 
 /* forward refs */
-static void handle_reply_msg(), whip_slave(), timeout_set(), timeout_unset();
+static void handle_reply_msg(), whip_slave(), fill_slave(), timeout_set(),
+timeout_unset(), abort_slaves(), flush_messages();
 
 /* names of files containing server hostnames */
 #define PERSONAL_SLAVEFILE ".mslaves"
@@ -115,8 +211,7 @@ static void handle_reply_msg(), whip_slave(), timeout_set(), timeout_unset();
 
 #define INITIAL_CHUNKS 1024
 
-#define MAX_WORKPACKET_SIZE 64
-#define DATAGRAM_BYTES 1200
+#define MAX_WORKPACKET_SIZE 	(MAX_DATAGRAM - sizeof(MessageHeader) - sizeof(MessageId))
 
 char *getenv();
 
@@ -192,8 +287,12 @@ int i;
 	slave *s = (slave *) malloc(sizeof(slave));
 	s->mi_count = 0L;
 	s->has_timeout = 0;
+	s->has_estimate = 0;
+	s->backoff = 0;
 	s->n_timeouts = s->n_packets = s->n_late_packets = 0;
 	s->disabled = 0;
+	s->in_flight = 0;
+	s->window = 1;
 	s->no = i;
 	s->backptr = wf;
 	return (s);
@@ -218,10 +317,12 @@ io_multiplex pipe_mux, socket_mux;
 
 	/* general initialization: */
 
-	/* set up the chunk index */
-	wf->max_chunks = INITIAL_CHUNKS;
-	wf->n_chunks = 0;
-	wf->chunks = (chunk **) malloc(wf->max_chunks * sizeof(chunk *));
+	/* set up the chunk arena and index */
+	wf->chunks.first = wf->chunks.current = (block *) 0;
+	wf->chunks.used = 0;
+	wf->chunks.max_chunks = INITIAL_CHUNKS;
+	wf->chunks.n_chunks = 0;
+	wf->chunks.index = (chunk **) malloc(INITIAL_CHUNKS * sizeof(chunk *));
 
 	/* set up the chunk queues */
 	wf->to_draw.prev = wf->to_draw.next = &wf->to_draw;
@@ -229,6 +330,12 @@ io_multiplex pipe_mux, socket_mux;
 
 	wf->pid = getpid();
 	wf->sequence = 0;
+	wf->can_abort = 0;
+	wf->n_out = 0;
+	wf->out_len = 0;
+	wf->out_buf = malloc(OUT_BYTES);
+	for (i = 0; i < N_PREC; i++)
+		wf->n_prec[i] = 0;
 
 #ifdef HAVE_SOCKETS
 	/* .mslaves file stuff */
@@ -260,7 +367,7 @@ io_multiplex pipe_mux, socket_mux;
 		s = new_slave(wf, 0);
 		/* s->name is not used */
 		s->name_string = "localhost";
-		s->timeout = timeout;
+		s->timeout = s->first_timeout = timeout;
 		wf->slaves[0] = s;
 		wf->n_slaves = 1;
 
@@ -285,7 +392,7 @@ io_multiplex pipe_mux, socket_mux;
 				 (char *)wf,
 				 /* this allocates space according to MAX_DATAGRAM_SIZE */
 				 malloc(sizeof(Message)), sizeof(Message),
-				 handle_reply_msg, wf_tick);
+				 handle_reply_msg, wf_tick, flush_messages);
 		close(pipe_to_server[READ]);
 		close(pipe_from_server[WRITE]);
 	}
@@ -353,7 +460,7 @@ io_multiplex pipe_mux, socket_mux;
 			s->name.sin_family = AF_INET;
 			s->name.sin_port = htons(port);
 			s->name_string = strdup(buf);
-			s->timeout = timeout;
+			s->timeout = s->first_timeout = timeout;
 			wf->slaves[i] = s;
 			i++;
 		}
@@ -372,9 +479,13 @@ io_multiplex pipe_mux, socket_mux;
 				 socket_mux, sock, sock, (char *)wf,
 				 /* this allocates space according to MAX_DATAGRAM_SIZE */
 				 malloc(sizeof(Message)), sizeof(Message),
-				 handle_reply_msg, wf_tick);
+				 handle_reply_msg, wf_tick, flush_messages);
+		wf->can_abort = 1;
 	}
 #endif				/* HAVE_SOCKETS */
+	wf->due = (slave **) malloc((wf->n_slaves + 1) * sizeof(slave *));
+	wf->n_due = 0;
+	wf->timer_at = -1;
 	return (wf);
 }
 
@@ -425,16 +536,133 @@ char *client_data;
 	slave *s = (slave *) client_data;
 	s->has_timeout = 0;
 	s->n_timeouts++;
-	whip_slave(s->backptr, s);
+	if (s->backoff < MAX_BACKOFF)
+		s->backoff++;
+	/* assume whatever was in flight is lost, and go slow for a while */
+	s->in_flight = 0;
+	s->window = 1;
+	fill_slave(s->backptr, s);
+	flush_messages((char *)s->backptr);
+}
+
+/* the time in milliseconds since some moment */
+
+static long wf_now()
+{
+	static long base;
+	struct timeval tv;
+	gettimeofday(&tv, (struct timezone *)0);
+	if (!base)
+		base = tv.tv_sec;
+	return ((tv.tv_sec - base) * 1000L + tv.tv_usec / 1000);
+}
+
+/* Count a reply that took "msec" milliseconds for a chunk of cost "cost" */
+
+static void estimate_rate(s, msec, cost)
+slave *s;
+long msec;
+double cost;
+{
+	double r = msec / cost;
+	if (!s->has_estimate) {
+		s->rate = r;
+		s->rate_dev = r / 2;
+		s->has_estimate = 1;
+	} else {
+		s->rate_dev += ((r > s->rate ? r - s->rate : s->rate - r)
+				- s->rate_dev) / 4;
+		s->rate += (r - s->rate) / 8;
+	}
+	s->backoff = 0;
+}
+
+/* Set the timeout of a slave for a chunk of cost "cost" */
+
+static void estimate_timeout(s, cost)
+slave *s;
+double cost;
+{
+	double t = s->has_estimate ?
+	    (s->rate + 4 * s->rate_dev) * cost : (double)s->first_timeout;
+	t *= 1 << s->backoff;
+	if (t < MIN_TIMEOUT)
+		t = MIN_TIMEOUT;
+	if (t > MAX_TIMEOUT)
+		t = MAX_TIMEOUT;
+	s->timeout = (unsigned)t;
+}
+
+#ifndef OLD_TIMEOUT
+
+/*
+  The slaves that have a timeout are kept in wf->due, a binary heap
+  ordered by timeout_at, and the I/O module is asked to tick when the
+  first one is due.  Timeouts are mostly pushed further into the
+  future, so the timer is only set again when the first one comes
+  sooner than it is set for; a tick that comes early finds nothing
+  due and sets it for the new first one.
+*/
+
+/* Put slave "s" in place "i" of the heap */
+
+#define DUE_PUT(wf, i, s) ((wf)->due[(i)] = (s), (s)->due_index = (i))
+
+/* Move the slave in place "i" of the heap up or down to where it belongs */
+
+static void due_fix(wf, i)
+wf_state *wf;
+unsigned int i;
+{
+	slave *s = wf->due[i];
+	unsigned int j;
+
+	while (i > 0 && wf->due[(i - 1) / 2]->timeout_at > s->timeout_at) {
+		DUE_PUT(wf, i, wf->due[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while ((j = 2 * i + 1) < wf->n_due) {
+		if (j + 1 < wf->n_due &&
+		    wf->due[j + 1]->timeout_at < wf->due[j]->timeout_at)
+			j++;
+		if (wf->due[j]->timeout_at >= s->timeout_at)
+			break;
+		DUE_PUT(wf, i, wf->due[j]);
+		i = j;
+	}
+	DUE_PUT(wf, i, s);
+}
+
+/* Ask the I/O module to tick when the first timeout is due */
+
+static void due_timer(wf, now)
+wf_state *wf;
+long now;
+{
+	if (wf->n_due == 0)
+		return;
+	wf->timer_at = wf->due[0]->timeout_at;
+	io_set_timer(wf->io, wf->timer_at > now ? wf->timer_at - now : 0L);
 }
 
+#endif				/* !OLD_TIMEOUT */
+
 /* Set a timeout for a slave; this is done when the slave is whipped. */
 
 static void timeout_set(s)
 slave *s;
 {
 #ifndef OLD_TIMEOUT
-	s->timeout_at = time((long *)0) + s->timeout / 1000;
+	wf_state *wf = s->backptr;
+	long now = wf_now();
+	s->timeout_at = now + (s->timeout ? s->timeout : 1);
+	if (!s->has_timeout) {
+		s->due_index = wf->n_due++;
+		wf->due[s->due_index] = s;
+	}
+	due_fix(wf, s->due_index);
+	if (wf->timer_at < 0 || wf->due[0]->timeout_at < wf->timer_at)
+		due_timer(wf, now);
 #else
 	/* first make sure there isn't a timeout already */
 	timeout_unset(s);
@@ -451,25 +679,121 @@ slave *s;
 #ifdef OLD_TIMEOUT
 	if (s->has_timeout)
 		wf_remove_timeout(s->timer_id);
+#else
+	wf_state *wf = s->backptr;
+	if (s->has_timeout && --wf->n_due > s->due_index) {
+		DUE_PUT(wf, s->due_index, wf->due[wf->n_due]);
+		due_fix(wf, s->due_index);
+	}
 #endif
 	s->has_timeout = 0;
 }
 
+/*
+  Send the "len" bytes at "m" to slave "s" with the next batch,
+  flushing the batch first if there is no room for them.
+*/
+
+static void send_message(wf, s, m, len)
+wf_state *wf;
+slave *s;
+char *m;
+unsigned int len;
+{
+	io_message *o;
+
+	if (wf->n_out == MAX_OUT || wf->out_len + len > OUT_BYTES)
+		flush_messages((char *)wf);
+	o = &wf->out[wf->n_out];
+	o->buffer = wf->out_buf + wf->out_len;
+	o->bufsize = len;
+	o->to = (char *)&s->name;
+	o->tolen = sizeof(s->name);
+	bcopy(m, o->buffer, len);
+	wf->out_slave[wf->n_out++] = s;
+	wf->out_len += (len + 7) & ~7;	/* keep the next one aligned */
+}
+
+/* Send the messages collected; a slave they can't be sent to is disabled */
+
+static void flush_messages(closure)
+char *closure;			/* really a wf_state* */
+{
+	wf_state *wf = (wf_state *) closure;
+	int i = 0;
+
+	while (i < wf->n_out) {
+		i += io_send_batch(wf->io, &wf->out[i], wf->n_out - i);
+		if (i < wf->n_out) {
+			slave *s = wf->out_slave[i++];
+			if (!s->disabled)
+				wf_warn
+				    ("error sending datagram, use of affected server disabled");
+			s->disabled = 1;	/* consider this slave unusable */
+		}
+	}
+	wf->n_out = 0;
+	wf->out_len = 0;
+}
+
+/*
+  Tell the slaves that may still be working for us that we no longer
+  want the "n" chunks numbered in "nos", or any chunk of the current
+  sequence if "n" is zero (see AbortMessage in ms_ipc.h).  Pipes can't
+  keep messages apart, so a slave at the end of one is not told.
+*/
+
+static void abort_slaves(wf, nos, n)
+wf_state *wf;
+unsigned int *nos;
+unsigned int n;
+{
+	uint16 buf[MAX_DATAGRAM / 2];	/* for alignment */
+	AbortMessage *m = (AbortMessage *) buf;
+	unsigned int i, j, k;
+
+	if (!wf->can_abort)
+		return;
+	m->header.magic = htons(MAGIC);
+	m->header.type = htons(ABORT_MESSAGE);
+	m->header.version = htons(VERSION);
+	m->header.format = htons(DATA_FORMAT);
+	m->id.pid = wf->pid;
+	m->id.seq = wf->sequence;
+	m->id.chunk_no = m->id.slave_no = 0;
+	i = 0;
+	do {			/* as many messages as it takes to list them */
+		for (j = 0; j < MAX_ABORT_CHUNKS && i < n; j++)
+			m->chunks[j] = nos[i++];
+		m->n_chunks = htons(j);
+		for (k = 0; k < wf->n_slaves; k++) {
+			slave *s = wf->slaves[k];
+			if (s->disabled || s->in_flight == 0)
+				continue;
+			send_message(wf, s, (char *)m,
+				     (char *)&m->chunks[j] - (char *)m);
+		}
+	} while (i < n);
+}
+
 /* Stop the slaves. */
 
 static void stop_slaves(wf)
 wf_state *wf;
 {
 	int i;
-	for (i = 0; i < wf->n_chunks; i++) {
-		chunk *c = wf->chunks[i];
-		free((char *)(c->client_data));
-		free((char *)(c->slave_data));
-		free((char *)c);
-	}
-	/* don't shrink the chunk index array; we probably need it again */
-	wf->n_chunks = 0;
+	/* whatever is still waiting to be sent is of no use now */
+	wf->n_out = 0;
+	wf->out_len = 0;
+	abort_slaves(wf, (unsigned int *)0, 0);
+	/* keep the blocks and the index; we probably need them again */
+	wf->chunks.current = wf->chunks.first;
+	wf->chunks.used = 0;
+	wf->chunks.n_chunks = 0;
 	wf->sequence++;
+	/* replies to the old sequence will be ignored, so don't wait for them */
+	for (i = 0; i < wf->n_slaves; i++)
+		wf->slaves[i]->in_flight = 0;
 	wf->drawn.prev = wf->drawn.next = &wf->drawn;
 }
 
@@ -489,6 +813,17 @@ slave *s;
 		return;
 
 	c = queue_head(&wf->to_draw);
+	while (c->n_sent == 0 && c->client &&
+	       (!s->has_estimate || s->rate * c->cost > SPLIT_TIME)) {
+		/* the pieces go in its place at the head of the queue */
+		wf->insert_point = c;
+		if (!wf_split(c->client, c->client_data))
+			break;
+		queue_delete(c);
+		queue_add(&wf->drawn, c);
+		c->drawn = 1;
+		c = queue_head(&wf->to_draw);
+	}
 	mm.m.header.magic = htons(MAGIC);
 	mm.m.header.type = htons(WHIP_MESSAGE);
 	mm.m.header.version = htons(VERSION);
@@ -502,19 +837,41 @@ slave *s;
 		wf_error("work packet too large");
 	bcopy(c->slave_data, mm.m.data, c->slave_datalen);
 
-	if (io_send(wf->io, (char *)&mm, sizeof(mm.m) + c->slave_datalen,
-		    (char *)&s->name, (int)sizeof(s->name)) == -1) {
-		wf_warn
-		    ("error sending datagram, use of affected server disabled");
-		s->disabled = 1;	/* consider this slave unusable */
-	}
+	send_message(wf, s, (char *)&mm, sizeof(mm.m) + c->slave_datalen);
 
+	/* it will most likely reply to this chunk first */
+	estimate_timeout(s, c->cost);
 	timeout_set(s);
+	if (s->in_flight++ == 0)
+		s->busy_since = wf_now();
+	c->sent_to = s->no;
+	c->n_sent++;
 	/* move the chunk from the head to the tail of the queue */
 	queue_delete(c);
 	queue_add(&wf->to_draw, c);
 }
 
+/*
+  Keep as many chunks in flight to a slave as it asks for (see the
+  "credit" field of the reply in ms_ipc.h).  The slave works on the
+  most recent one first, so the chunks that are likely to be sent to
+  another slave too are the ones it will get to last.  Don't send a
+  chunk to it again while it is still working on it; that would only
+  happen at the end of a sequence, when there are fewer chunks left
+  than places for them.
+*/
+
+static void fill_slave(wf, s)
+wf_state *wf;
+slave *s;
+{
+	while (!s->disabled && s->in_flight < s->window &&
+	       !queue_empty(&wf->to_draw) &&
+	       (s->in_flight == 0 ||
+		queue_head(&wf->to_draw)->sent_to != s->no))
+		whip_slave(wf, s);
+}
+
 /* Handle a reply from a slave. */
 
 static void handle_reply_msg(closure, msg, msglen)
@@ -544,11 +901,21 @@ int msglen;
 		s->n_late_packets++;
 		return;
 	}
-	if (chunkno >= wf->n_chunks)
+	if (chunkno >= wf->chunks.n_chunks)
 		return;
-	c = wf->chunks[chunkno];
+	c = wf->chunks.index[chunkno];
 
 	timeout_unset(s);
+	if (s->in_flight > 0) {
+		long now = wf_now();
+		if (c->n_sent == 1 && c->cost > 0)
+			estimate_rate(s, now - s->busy_since, c->cost);
+		s->busy_since = now;
+		s->in_flight--;
+	}
+	s->window = ntohs(msg->reply.credit);
+	if (s->window < 1)
+		s->window = 1;
 
 	client = c->client;
 
@@ -567,11 +934,15 @@ int msglen;
 	}
 
 	/* Put the slave to work again */
-	whip_slave(wf, s);
+	fill_slave(wf, s);
+	if (s->in_flight > 0 && !s->has_timeout)
+		timeout_set(s);
 
 	if (!late) {
 		wf_draw(client, c->client_data, (char *)&(msg->reply.data));
 		s->mi_count += ntohl(msg->reply.mi_count);
+		if (ntohs(msg->reply.precision) < N_PREC)
+			wf->n_prec[ntohs(msg->reply.precision)]++;
 	}
 
 	/* If done, stop all the slaves and deallocate the chunks */
@@ -589,6 +960,45 @@ wf_state *wf;
 	wf->insert_point = wf->to_draw.next;
 }
 
+/*
+  Allocate "n" bytes from the arena "a", going on to the next block if
+  they don't fit in the current one, and adding a block if there is no
+  next one or it is too small.
+*/
+
+static char *arena_alloc(a, n)
+arena *a;
+unsigned int n;
+{
+	block *b = a->current;
+	char *p;
+
+	n = ARENA_ROUND(n);
+	if (b && a->used + n <= b->size) {
+		p = BLOCK_SPACE(b) + a->used;
+		a->used += n;
+		return (p);
+	}
+	if (b && b->next && n <= b->next->size)
+		b = b->next;
+	else {
+		unsigned int size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+		block *nb = (block *) malloc(ARENA_ROUND(sizeof(block)) + size);
+		nb->size = size;
+		if (b) {
+			nb->next = b->next;
+			b->next = nb;
+		} else {
+			nb->next = a->first;
+			a->first = nb;
+		}
+		b = nb;
+	}
+	a->current = b;
+	a->used = n;
+	return (BLOCK_SPACE(b));
+}
+
 /*
   This function is called by the Ms widget for each chunk it 
   wants to be calculated.
@@ -596,32 +1006,38 @@ wf_state *wf;
 
 void
 wf_dispatch_chunk(wf, client, client_data, client_datalen,
-		  slave_data, slave_datalen)
+		  slave_data, slave_datalen, cost)
 wf_state *wf;
 char *client;
 char *client_data;
 unsigned int client_datalen;
 char *slave_data;
 unsigned int slave_datalen;
+double cost;
 {
-	int chunkno = wf->n_chunks++;
-	chunk *c = (chunk *) malloc(sizeof(chunk));
-	c->client_data = (char *)malloc(client_datalen);
+	arena *a = &wf->chunks;
+	int chunkno = a->n_chunks++;
+	chunk *c = (chunk *) arena_alloc(a, ARENA_ROUND(sizeof(chunk)) +
+					 ARENA_ROUND(client_datalen) +
+					 slave_datalen);
+	c->client_data = (char *)c + ARENA_ROUND(sizeof(chunk));
 	bcopy(client_data, c->client_data, client_datalen);
-	c->slave_data = (char *)malloc(slave_datalen);
+	c->slave_data = c->client_data + ARENA_ROUND(client_datalen);
 	bcopy(slave_data, c->slave_data, slave_datalen);
 	c->slave_datalen = slave_datalen;
 	c->client = client;
 	c->drawn = 0;
 	c->no = chunkno;
+	c->sent_to = -1;
+	c->n_sent = 0;
+	c->cost = cost;
 	/* grow the chunk index if necessary */
-	if (chunkno >= wf->max_chunks) {
-		wf->max_chunks *= 2;
-		wf->chunks = (chunk **) realloc((char *)wf->chunks,
-						wf->max_chunks *
-						sizeof(chunk *));
+	if (chunkno >= a->max_chunks) {
+		a->max_chunks *= 2;
+		a->index = (chunk **) realloc((char *)a->index,
+					      a->max_chunks * sizeof(chunk *));
 	}
-	wf->chunks[chunkno] = c;
+	a->index[chunkno] = c;
 	queue_add(wf->insert_point, c);
 }
 
@@ -632,34 +1048,94 @@ wf_state *wf;
 {
 	int i;
 	for (i = 0; i < wf->n_slaves; i++) {
-		whip_slave(wf, wf->slaves[i]);
+		fill_slave(wf, wf->slaves[i]);
 	}
+	flush_messages((char *)wf);
 }
 
-/* Handle the situation of a client aborting prematurely. */
+/*
+  Take the chunks of client "cli" off the work queue and tell the
+  slaves to forget them.  If "notify", wf_draw() is called for each
+  with a null data pointer; otherwise their client pointer fields are
+  nullified so that late packets won't reference the client.
+*/
 
-void wf_client_died(wf, cli)
+static void cancel_chunks(wf, cli, notify)
 wf_state *wf;
 char *cli;
+int notify;
 {
 	chunk *c;
 	chunk *next_c;
-	/* Remove all chunks of the dead widget from the work queue */
-	/* and nullify their widget pointer fields so that late packets */
-	/* won't reference the nonexistent widget */
+	unsigned int *nos;
+	unsigned int n = 0, n_sent = 0, i;
+
+	if (wf->chunks.n_chunks == 0)
+		return;
+	nos = (unsigned int *)malloc(wf->chunks.n_chunks *
+				     sizeof(unsigned int));
 	for (c = wf->to_draw.next; c != &wf->to_draw; c = next_c) {	/* need to use a temporary variable because */
 		/* relinking the chunk fouls up the .next field */
 		next_c = c->next;
 		if (c->client == cli) {
-			c->client = NULL;
 			queue_delete(c);
 			queue_add(&wf->drawn, c);
+			c->drawn = 1;
+			if (!notify)
+				c->client = NULL;
+			/* the sent ones first, the rest at the end */
+			if (c->sent_to >= 0) {
+				nos[n++] = nos[n_sent];
+				nos[n_sent++] = c->no;
+			} else
+				nos[n++] = c->no;
 		}
 	}
+	if (n == 0) {
+		free((char *)nos);
+		return;
+	}
+	if (notify)
+		for (i = 0; i < n; i++)
+			wf_draw(cli, wf->chunks.index[nos[i]]->client_data,
+				(char *)0);
+	/* with nothing left to do in the sequence, stop_slaves() aborts it */
+	if (queue_empty(&wf->to_draw))
+		stop_slaves(wf);
+	else
+		abort_slaves(wf, nos, n_sent);
+	flush_messages((char *)wf);
+	free((char *)nos);
+}
+
+/* Handle the situation of a client aborting prematurely. */
+
+void wf_client_died(wf, cli)
+wf_state *wf;
+char *cli;
+{
+	cancel_chunks(wf, cli, 0);
+}
+
+/*
+  Handle a client that no longer wants the chunks it has dispatched,
+  as when it has been zoomed.
+*/
+
+void wf_cancel(wf, cli)
+wf_state *wf;
+char *cli;
+{
+	cancel_chunks(wf, cli, 1);
 }
 
 /* Print performance statistics. */
 
+static char *prec_names[N_PREC] = {
+	"fixed", "float", "double", "double-double", "multiple", "perturbation",
+	"fixed64"
+};
+
 void wf_print_stats(wf, f)
 wf_state *wf;
 FILE *f;
@@ -667,27 +1143,35 @@ FILE *f;
 	int i;
 	int active = 0;
 	unsigned long mi_tot = 0;
-	fprintf(f, "\n%-22s %10s %10s %10s %10s\n",
-		"Host", "iterations", "packets", "timeouts", "late");
+	fprintf(f, "\n%-22s %10s %10s %10s %10s %10s\n",
+		"Host", "iterations", "packets", "timeouts", "late", "timeout");
 	for (i = 0; i < wf->n_slaves; i++) {
 		slave *s = wf->slaves[i];
-		fprintf(f, "%-22s %10lu %10u %10u %10u\n",
+		fprintf(f, "%-22s %10lu %10u %10u %10u %8ums\n",
 			s->name_string,
 			s->mi_count, s->n_packets, s->n_timeouts,
-			s->n_late_packets);
+			s->n_late_packets, s->timeout);
 		if (s->mi_count)
 			active++;
 		mi_tot += s->mi_count;
 	}
 	fprintf(f, "%d servers, %d active, %lu iterations total\n",
 		wf->n_slaves, active, mi_tot);
+	fprintf(f, "chunks by precision:");
+	for (i = 0; i < N_PREC; i++)
+		if (wf->n_prec[i])
+			fprintf(f, " %s %lu", prec_names[i], wf->n_prec[i]);
+	fprintf(f, "\n");
 	fflush(f);
 }
 
-/* Make information about the maximum message size available. */
+/*
+  Make information about the maximum message size available.  This is
+  the largest reply the servers send, packed or not.
+*/
 unsigned wf_max_message_size()
 {
-	return (DATAGRAM_BYTES - sizeof(ReplyHeader));
+	return (MAX_DATAGRAM - sizeof(ReplyHeader));
 }
 
 #ifndef OLD_TIMEOUT
@@ -695,15 +1179,15 @@ void wf_tick(closure)
 char *closure;
 {
 	wf_state *wf = (wf_state *) closure;
-	int i;
-	unsigned n_slaves = wf->n_slaves;
-	long now = time((long *)0);
-	for (i = 0; i < n_slaves; i++) {
-		slave *s = s = wf->slaves[i];
-		if (s->has_timeout && s->timeout_at <= now) {
-			wf_timed_out((char *)s);
-		}
+	long now = wf_now();
+	slave *s;
+
+	wf->timer_at = -1;
+	while (wf->n_due > 0 && (s = wf->due[0])->timeout_at <= now) {
+		timeout_unset(s);
+		wf_timed_out((char *)s);
 	}
+	due_timer(wf, now);
 }
 #endif
 
@@ -10,7 +10,8 @@ typedef struct wf_state wf_state;
 /* 
    wf=wf_init(timeout, pipe_mux, socket_mux): initialize the work
    distribution system.  "timeout" should be well larger than the time
-   to complete a single work packet (in milliseconds).
+   to complete a single work packet (in milliseconds); it is used until
+   the time the servers take has been measured.
    The multiplexer "pipe_mux" is used for pipe input, 
    "socket_mux" for socket input.
 */
@@ -20,7 +21,10 @@ struct wf_state *wf_init();
 void wf_begin_dispatch();
 
 /* wf_dispatch_chunk(wf, client, client_data, client_datalen, 
-     slave_data, slave_datalen): give a piece of work to the workforce */
+     slave_data, slave_datalen, cost): give a piece of work to the
+     workforce.  "cost" (a double) is the most work it can take, in any
+     unit as long as it is the same for all the chunks; the timeouts
+     are scaled by it. */
 void wf_dispatch_chunk();
 
 /* wf_restart(wf): make sure the computation servers are at work */
@@ -36,6 +40,10 @@ void wf_timed_out();
    despite outstanding requests */
 void wf_client_died();
 
+/* wf_cancel(wf, client): call when client no longer wants the chunks
+   it has dispatched; wf_draw() is called for each with null data */
+void wf_cancel();
+
 /* wf_print_stats(wf): print statistics about server performance */
 void wf_print_stats();
 
@@ -53,4 +61,10 @@ void wf_tick();
 void wf_error();		/* error reporting */
 void wf_warn();
 
-void wf_draw();			/* callback */
+void wf_draw();			/* callback; data is null if cancelled */
+
+/* wf_split(client, client_data): callback; dispatch the chunk again in
+   smaller pieces (without calling wf_begin_dispatch() or wf_restart())
+   and return nonzero, or return zero if it can't be split.  No
+   wf_draw() call is made for a chunk that has been split. */
+int wf_split();
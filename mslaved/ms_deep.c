@@ -0,0 +1,318 @@
+/* ms_deep.c - deep zooming by perturbation, for the computation server */
+
+/*
+    This file is part of MandelSpawn, a network Mandelbrot program.
+
+    Copyright (C) 1990-1993 Andreas Gustafsson
+
+    MandelSpawn is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License, version 1,
+    as published by the Free Software Foundation.
+
+    MandelSpawn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License,
+    version 1, along with this program; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+  This file handles MS_OPT_DEEP jobs (see ms_job.h).  The orbit Z of
+  the reference point C is calculated once in multiple precision and
+  kept as doubles.  Any other point C + dc then has the orbit Z + d,
+  where
+
+	d' = 2 Z d + d^2 + dc
+
+  and d is small enough to be calculated in ordinary floating point
+  even when dc is far below the resolution of a double near C.
+
+  Two things make this practical.  First, the early iterations of d
+  are well approximated by a series in dc,
+
+	d = A dc + B dc^2 + C dc^3,
+
+  whose coefficients depend only on the reference orbit; as long as
+  the last term is negligible for every pixel of a chunk, the whole
+  chunk can skip that many iterations.  Second, the perturbation loses
+  precision ("glitches") when Z + d comes close to zero, which is
+  where |Z + d| < |d|.  Instead of detecting the damage afterwards, the
+  point is then rebased: Z + d becomes the new d and the reference
+  orbit is restarted from its beginning, where Z = 0.  This also takes
+  care of pixels that outlive a reference point which escapes.
+
+  Perturbed deltas are doubles, so pixel spacings down to about 1e-300
+  work; the reference point is limited to MP_MAX_LIMBS limbs anyway.
+*/
+
+#include "mpfix.c"
+
+/*
+  It is impossible to declare malloc() in a portable way.
+  Be prepared to change these declarations.
+*/
+void *malloc();
+void free();
+
+/*
+  The reference orbit, and the series coefficients for each iteration.
+  It is kept until a job with a different reference point or a higher
+  iteration limit arrives.
+*/
+static double *ref_re, *ref_im;	/* Z */
+static double *ser_ar, *ser_ai;	/* A */
+static double *ser_br, *ser_bi;	/* B */
+static double *ser_cr, *ser_ci;	/* C */
+static unsigned int ref_len;	/* number of iterations in the orbit */
+static unsigned int ref_maxiter;	/* the limit it was calculated to */
+static int ref_limbs;		/* the reference point, as received */
+static uint32 ref_point[2 * MP_MAX_LIMBS];
+
+/* the chunk being calculated */
+static int deep_ox, deep_oy;	/* twice the pixel coordinates, less origin */
+static double deep_hdx, deep_hdy;	/* half the pixel spacing */
+static unsigned int deep_skip;	/* iterations skipped by the series */
+static double deep_ar, deep_ai, deep_br, deep_bi, deep_cr, deep_ci;
+static unsigned int deep_bytes;	/* bytes per count */
+static unsigned int deep_maxiter;
+
+/* the series is used while its last term is this small relative to */
+/* the first; the terms left out are smaller still */
+#define SERIES_TOL (1.0 / 4294967296.0)
+
+#define DEEP_ABS(x) ((x) < 0 ? -(x) : (x))
+#define DEEP_MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/* an easy approximation of |z|, within a factor of sqrt(2) */
+#define MAG(re, im) DEEP_MAX(DEEP_ABS(re), DEEP_ABS(im))
+
+/* make room for an orbit of "n" iterations */
+
+static void deep_alloc(n)
+unsigned int n;
+{
+	static unsigned int allocated = 0;
+	double **arrays[8];
+	int i;
+	if (n <= allocated)
+		return;
+	arrays[0] = &ref_re;
+	arrays[1] = &ref_im;
+	arrays[2] = &ser_ar;
+	arrays[3] = &ser_ai;
+	arrays[4] = &ser_br;
+	arrays[5] = &ser_bi;
+	arrays[6] = &ser_cr;
+	arrays[7] = &ser_ci;
+	for (i = 0; i < 8; i++) {
+		if (allocated)
+			free((char *)*arrays[i]);
+		*arrays[i] = (double *)malloc(n * sizeof(double));
+		if (!*arrays[i])
+			error("out of memory for reference orbit");
+	}
+	allocated = n;
+}
+
+/* calculate the orbit of the reference point "c" */
+
+static void deep_orbit(c_re, c_im, maxiter)
+mpfix *c_re, *c_im;
+unsigned int maxiter;
+{
+	mpfix z_re, z_im, t_re, t_im, t;
+	unsigned int k;
+	int i;
+
+	deep_alloc(maxiter);
+	z_re.limbs = z_im.limbs = c_re->limbs;
+	for (i = 0; i < c_re->limbs; i++)
+		z_re.l[i] = z_im.l[i] = 0;
+	ref_re[0] = ref_im[0] = 0.0;
+	ser_ar[0] = ser_ai[0] = ser_br[0] = ser_bi[0] = 0.0;
+	ser_cr[0] = ser_ci[0] = 0.0;
+
+	for (k = 1; k < maxiter; k++) {
+		double zr = ref_re[k - 1], zi = ref_im[k - 1];
+		double ar = ser_ar[k - 1], ai = ser_ai[k - 1];
+		double br = ser_br[k - 1], bi = ser_bi[k - 1];
+		double cr = ser_cr[k - 1], ci = ser_ci[k - 1];
+
+		/* Z = Z^2 + C */
+		mp_mul(&t_re, &z_re, &z_re);
+		mp_mul(&t, &z_im, &z_im);
+		mp_sub(&t_re, &t_re, &t);
+		mp_mul(&t_im, &z_re, &z_im);
+		mp_add(&t_im, &t_im, &t_im);
+		mp_add(&z_re, &t_re, c_re);
+		mp_add(&z_im, &t_im, c_im);
+		ref_re[k] = mp_to_double(&z_re);
+		ref_im[k] = mp_to_double(&z_im);
+
+		/* A = 2ZA + 1, B = 2ZB + A^2, C = 2ZC + 2AB */
+		ser_ar[k] = 2.0 * (zr * ar - zi * ai) + 1.0;
+		ser_ai[k] = 2.0 * (zr * ai + zi * ar);
+		ser_br[k] = 2.0 * (zr * br - zi * bi) + (ar * ar - ai * ai);
+		ser_bi[k] = 2.0 * (zr * bi + zi * br) + 2.0 * ar * ai;
+		ser_cr[k] = 2.0 * (zr * cr - zi * ci + ar * br - ai * bi);
+		ser_ci[k] = 2.0 * (zr * ci + zi * cr + ar * bi + ai * br);
+
+		if (ref_re[k] * ref_re[k] + ref_im[k] * ref_im[k] > 4.0) {
+			k++;
+			break;
+		}
+	}
+	ref_len = k;
+	ref_maxiter = maxiter;
+}
+
+/*
+  Find how many iterations the series can skip for a chunk whose
+  pixels are all within "r" of the reference point.  Besides being
+  accurate, the series must keep every pixel inside the escape radius
+  at each iteration skipped, since the pixel would have been counted
+  as escaping there.
+*/
+
+static unsigned int deep_series(r, maxiter)
+double r;
+unsigned int maxiter;
+{
+	unsigned int k;
+	for (k = 1; k < ref_len && k < maxiter - 1; k++) {
+		double a = MAG(ser_ar[k], ser_ai[k]) * r;
+		double b = MAG(ser_br[k], ser_bi[k]) * r * r;
+		double c = MAG(ser_cr[k], ser_ci[k]) * r * r * r;
+		if (!(c <= a * SERIES_TOL && a + b + c < 1.0 / 1024 &&
+		      ref_re[k] * ref_re[k] + ref_im[k] * ref_im[k] < 3.9))
+			break;
+	}
+	return k - 1;
+}
+
+/*
+  Set up for a deep zoom job "dj" for the chunk at (xmin, ymin) of size
+  w by h.  Returns zero if the job is malformed.
+*/
+
+static int deep_setup(dj, xmin, ymin, w, h, bytes_per_count, maxiter)
+ms_deep_job *dj;
+int xmin, ymin, w, h;
+unsigned int bytes_per_count;
+unsigned int maxiter;
+{
+	int limbs = ntohs(dj->limbs);
+	mpfix c_re, c_im, d;
+	double rx, ry, r;
+	int i;
+
+	if (limbs < 2 || limbs > MP_MAX_LIMBS)
+		return (0);
+
+	/* calculate the reference orbit unless we already have it */
+	for (i = 0; i < 2 * limbs; i++)
+		if (dj->data[i] != ref_point[i])
+			break;
+	if (limbs != ref_limbs || i < 2 * limbs ||
+	    (maxiter > ref_maxiter && ref_len == ref_maxiter)) {
+		mp_from_net(&c_re, &dj->data[0], limbs);
+		mp_from_net(&c_im, &dj->data[limbs], limbs);
+		deep_orbit(&c_re, &c_im, maxiter);
+		ref_limbs = limbs;
+		for (i = 0; i < 2 * limbs; i++)
+			ref_point[i] = dj->data[i];
+	}
+
+	mp_from_net(&d, &dj->data[2 * limbs], limbs);
+	deep_hdx = mp_to_double(&d) / 2.0;
+	mp_from_net(&d, &dj->data[3 * limbs], limbs);
+	deep_hdy = mp_to_double(&d) / 2.0;
+	deep_ox = 2 * xmin - ntohli(dj->origin_x2);
+	deep_oy = 2 * ymin - ntohli(dj->origin_y2);
+	deep_bytes = bytes_per_count;
+	deep_maxiter = maxiter;
+
+	/* the distance from the reference point to the farthest corner */
+	rx = DEEP_MAX(DEEP_ABS(deep_ox), DEEP_ABS(deep_ox + 2 * (w - 1))) *
+	    DEEP_ABS(deep_hdx);
+	ry = DEEP_MAX(DEEP_ABS(deep_oy), DEEP_ABS(deep_oy + 2 * (h - 1))) *
+	    DEEP_ABS(deep_hdy);
+	r = DEEP_MAX(rx, ry) * 1.5;	/* more than sqrt(2) */
+	deep_skip = deep_series(r, maxiter);
+	deep_ar = ser_ar[deep_skip];
+	deep_ai = ser_ai[deep_skip];
+	deep_br = ser_br[deep_skip];
+	deep_bi = ser_bi[deep_skip];
+	deep_cr = ser_cr[deep_skip];
+	deep_ci = ser_ci[deep_skip];
+	return (1);
+}
+
+/* iterate the point at "dc" from the reference point */
+
+static unsigned int deep_point(dc_re, dc_im, maxiter)
+double dc_re, dc_im;
+unsigned int maxiter;
+{
+	double d_re, d_im, z_re, z_im, t_re, t_im, t, mag2;
+	unsigned int m, count;
+
+	/* d = ((C dc + B) dc + A) dc */
+	t_re = deep_cr * dc_re - deep_ci * dc_im + deep_br;
+	t_im = deep_cr * dc_im + deep_ci * dc_re + deep_bi;
+	t = t_re * dc_re - t_im * dc_im + deep_ar;
+	t_im = t_re * dc_im + t_im * dc_re + deep_ai;
+	d_re = t * dc_re - t_im * dc_im;
+	d_im = t * dc_im + t_im * dc_re;
+
+	m = count = deep_skip;
+	while (count < maxiter - 1) {
+		z_re = ref_re[m] + d_re;
+		z_im = ref_im[m] + d_im;
+		mag2 = z_re * z_re + z_im * z_im;
+		if (mag2 >= 4.0)
+			break;
+		if (mag2 < d_re * d_re + d_im * d_im || m == ref_len - 1) {
+			d_re = z_re;	/* rebase */
+			d_im = z_im;
+			m = 0;
+		}
+		/* d = (2Z + d) d + dc */
+		t_re = 2.0 * ref_re[m] + d_re;
+		t_im = 2.0 * ref_im[m] + d_im;
+		t = t_re * d_re - t_im * d_im + dc_re;
+		d_im = t_re * d_im + t_im * d_re + dc_im;
+		d_re = t;
+		m++;
+		count++;
+	}
+	return count;
+}
+
+/*
+  Calculate "n" pixels of the chunk starting at (x, y) and going right,
+  storing the counts at "out".  Returns the number of iterations.
+*/
+
+static unsigned long deep_row(x, y, n, out)
+int x, y, n;
+char *out;
+{
+	double dc_im = (double)(deep_oy + 2 * y) * deep_hdy;
+	unsigned long mi_count = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned int count =
+		    deep_point((double)(deep_ox + 2 * (x + i)) * deep_hdx,
+			       dc_im, deep_maxiter);
+		if (deep_bytes == 1)
+			STORE_8(out, i, count);
+		else
+			STORE_16(out, i, count);
+		mi_count += count;
+	}
+	return mi_count;
+}
@@ -0,0 +1,522 @@
+/* ms_mp.c - multiple-precision iteration, for the computation server */
+
+/*
+    This file is part of MandelSpawn, a network Mandelbrot program.
+
+    Copyright (C) 1990-1993 Andreas Gustafsson
+
+    MandelSpawn is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License, version 1,
+    as published by the Free Software Foundation.
+
+    MandelSpawn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License,
+    version 1, along with this program; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+  This file handles MS_OPT_MP jobs (see ms_job.h), where every pixel
+  is iterated in multiple-precision fixed point.  The routines in
+  mpfix.c (#included by ms_deep.c) are fine for setting up a chunk but
+  much too slow for the iteration itself, so it has its own versions
+  here.  They take the number of limbs as an argument that is a
+  constant at every call site (see MP_KERNEL below), so that the
+  compiler can unroll their loops completely for each size.
+
+  Products are formed a column at a time, and only the columns that
+  can affect the limbs kept are formed at all: of the 2n - 1 columns
+  of an n-limb product, the lowest n - 2 are skipped, which makes the
+  result up to n units of its last place too small.  Squares also use
+  each cross product twice instead of forming it twice.
+
+  Many of these jobs don't need all that, though.  As part of the
+  precision ladder (see mslaved.c), chunks where a "real" is accurate
+  enough are passed on to the usual kernels (the vector ones if "real"
+  is a double), and chunks where a double-double is are iterated in
+  that.
+*/
+
+/* r = -a; r may be a */
+
+static inline void mpk_neg(r, a, n)
+uint32 *r, *a;
+int n;
+{
+	uint64 carry = 1;
+	int i;
+	for (i = 0; i < n; i++) {
+		carry += (uint32) ~ a[i];
+		r[i] = (uint32) carry;
+		carry >>= MP_LIMB_BITS;
+	}
+}
+
+/* r = |a|; returns true if a was negative */
+
+static inline int mpk_abs(r, a, n)
+uint32 *r, *a;
+int n;
+{
+	int i;
+	if (a[n - 1] & 0x80000000) {
+		mpk_neg(r, a, n);
+		return (1);
+	}
+	for (i = 0; i < n; i++)
+		r[i] = a[i];
+	return (0);
+}
+
+/* r = a + b, or 2 a + b if "twice" */
+
+static inline void mpk_add(r, a, b, n, twice)
+uint32 *r, *a, *b;
+int n;
+int twice;
+{
+	uint64 carry = 0;
+	uint32 top = 0;		/* the bit shifted out of the limb below */
+	int i;
+	for (i = 0; i < n; i++) {
+		uint32 ai = a[i];
+		if (twice) {
+			uint32 t = (ai << 1) | top;
+			top = ai >> 31;
+			ai = t;
+		}
+		carry += (uint64) ai + b[i];
+		r[i] = (uint32) carry;
+		carry >>= MP_LIMB_BITS;
+	}
+}
+
+/* r = a - b */
+
+static inline void mpk_sub(r, a, b, n)
+uint32 *r, *a, *b;
+int n;
+{
+	uint64 borrow = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		uint64 d = (uint64) a[i] - b[i] - borrow;
+		r[i] = (uint32) d;
+		borrow = (d >> MP_LIMB_BITS) & 1;
+	}
+}
+
+/*
+  The column accumulator: "lo" and "hi" hold the sum of a column of
+  products plus the carry from the columns below.
+*/
+
+#define MPK_ACC(lo, hi, p) \
+	do { uint64 p_ = (p); (lo) += p_; (hi) += ((lo) < p_); } while (0)
+
+/* store column s, and move the carry over to the next one */
+#define MPK_COLUMN(r, n, s, lo, hi) \
+	do { \
+		if ((s) >= (n) - 1) \
+			(r)[(s) - (n) + 1] = (uint32) (lo); \
+		(lo) = ((lo) >> 32) | ((uint64) (hi) << 32); \
+		(hi) = 0; \
+	} while (0)
+
+/* r = a * b, truncated, for non-negative a and b */
+
+static inline void mpk_mul(r, a, b, n)
+uint32 *r, *a, *b;
+int n;
+{
+	uint64 lo = 0;
+	uint32 hi = 0;
+	int s, i;
+	for (s = n - 2; s <= 2 * n - 2; s++) {
+		for (i = (s < n ? 0 : s - n + 1); i <= (s < n ? s : n - 1); i++)
+			MPK_ACC(lo, hi, (uint64) a[i] * b[s - i]);
+		MPK_COLUMN(r, n, s, lo, hi);
+	}
+}
+
+/* r = a * a, truncated, for non-negative a */
+
+static inline void mpk_sqr(r, a, n)
+uint32 *r, *a;
+int n;
+{
+	uint64 lo = 0, clo;
+	uint32 hi = 0, chi;
+	int s, i;
+	for (s = n - 2; s <= 2 * n - 2; s++) {
+		/* the cross products of the column, doubled */
+		clo = 0;
+		chi = 0;
+		for (i = (s < n ? 0 : s - n + 1); i < s - i; i++)
+			MPK_ACC(clo, chi, (uint64) a[i] * a[s - i]);
+		chi = (chi << 1) | (uint32) (clo >> 63);
+		clo <<= 1;
+		if ((s & 1) == 0)
+			MPK_ACC(clo, chi, (uint64) a[s / 2] * a[s / 2]);
+		MPK_ACC(lo, hi, clo);
+		hi += chi;
+		MPK_COLUMN(r, n, s, lo, hi);
+	}
+}
+
+/*
+  Iterate a single point and return the iteration count, like
+  mandelbrot() in mslaved.c.  Since fixed-point arithmetic is exact
+  and deterministic, the limit cycle detection works as usual.
+*/
+
+static inline unsigned int mpk_iterate(c_re, c_im, z_re, z_im, maxiter,
+				       show_interior, n)
+uint32 *c_re, *c_im, *z_re, *z_im;
+unsigned int maxiter;
+int show_interior;
+int n;
+{
+	uint32 x_re[MS_MP_MAX_LIMBS], x_im[MS_MP_MAX_LIMBS];
+	uint32 a_re[MS_MP_MAX_LIMBS], a_im[MS_MP_MAX_LIMBS];
+	uint32 xresq[MS_MP_MAX_LIMBS], ximsq[MS_MP_MAX_LIMBS];
+	uint32 t[MS_MP_MAX_LIMBS];
+	uint32 old_re[MS_MP_MAX_LIMBS], old_im[MS_MP_MAX_LIMBS];
+	unsigned int count;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		x_re[i] = z_re[i];
+		x_im[i] = z_im[i];
+	}
+	count = 0;
+	while (count < maxiter - 1) {
+		if (cycle_detect) {
+			if ((count & (count - 1)) == 0) {
+				for (i = 0; i < n; i++) {
+					old_re[i] = x_re[i];
+					old_im[i] = x_im[i];
+				}
+			} else {
+				for (i = 0; i < n; i++)
+					if (x_re[i] != old_re[i] ||
+					    x_im[i] != old_im[i])
+						break;
+				if (i == n) {
+					if (!show_interior)
+						count = maxiter - 1;
+					break;
+				}
+			}
+		}
+		/* z := z^2 + c, on the magnitudes of the parts of z */
+		i = mpk_abs(a_re, x_re, n) != mpk_abs(a_im, x_im, n);
+		mpk_sqr(xresq, a_re, n);
+		mpk_sqr(ximsq, a_im, n);
+		mpk_add(t, xresq, ximsq, n, 0);
+		if (t[n - 1] >= 4)
+			break;
+		mpk_mul(t, a_re, a_im, n);
+		if (i)
+			mpk_neg(t, t, n);
+		mpk_add(x_im, t, c_im, n, 1);
+		mpk_sub(t, xresq, ximsq, n);
+		mpk_add(x_re, t, c_re, n, 0);
+		count++;
+	}
+	return count;
+}
+
+/* the kernels for 64, 128, 192 and 256 bits */
+
+#define MP_KERNEL(name, n) \
+static unsigned int name(c_re, c_im, z_re, z_im, maxiter, show_interior) \
+uint32 *c_re, *c_im, *z_re, *z_im; \
+unsigned int maxiter; \
+int show_interior; \
+{ \
+	return (mpk_iterate(c_re, c_im, z_re, z_im, maxiter, \
+			    show_interior, n)); \
+}
+
+MP_KERNEL(mp_kernel_64, 2)
+MP_KERNEL(mp_kernel_128, 4)
+MP_KERNEL(mp_kernel_192, 6)
+MP_KERNEL(mp_kernel_256, 8)
+
+static unsigned int (*mp_kernels[]) () = {
+	mp_kernel_64, mp_kernel_128, mp_kernel_192, mp_kernel_256
+};
+
+/*
+  Double-double arithmetic: a number is the unevaluated sum of two
+  doubles "hi" and "lo", with |lo| at most half a unit in the last
+  place of hi, which gives about 106 bits.  These are the usual
+  algorithms of Dekker and Knuth; they rely on every operation being
+  rounded separately, which ms_real.c makes sure of.
+*/
+
+/* s + e = a + b exactly, if |a| >= |b| */
+#define QUICK_TWO_SUM(a, b, s, e) \
+	do { s = (a) + (b); e = (b) - (s - (a)); } while (0)
+
+/* s + e = a + b exactly */
+#define TWO_SUM(a, b, s, e) \
+	do { double v_; s = (a) + (b); v_ = s - (a); \
+	     e = ((a) - (s - v_)) + ((b) - v_); } while (0)
+
+/* hi + lo = a, each with at most 26 significant bits */
+#define SPLIT(a, hi, lo) \
+	do { double t_ = 134217729.0 * (a); \
+	     hi = t_ - (t_ - (a)); lo = (a) - hi; } while (0)
+
+/* p + e = a * b exactly */
+#define TWO_PROD(a, b, p, e) \
+	do { double ah_, al_, bh_, bl_; p = (a) * (b); \
+	     SPLIT(a, ah_, al_); SPLIT(b, bh_, bl_); \
+	     e = ((ah_ * bh_ - p) + ah_ * bl_ + al_ * bh_) + al_ * bl_; \
+	} while (0)
+
+/* (rh, rl) = (ah, al) * (bh, bl) */
+#define DD_MUL(ah, al, bh, bl, rh, rl) \
+	do { double p_, e_; TWO_PROD(ah, bh, p_, e_); \
+	     e_ += (ah) * (bl) + (al) * (bh); \
+	     QUICK_TWO_SUM(p_, e_, rh, rl); } while (0)
+
+/* (rh, rl) = (ah, al) + (bh, bl) */
+#define DD_ADD(ah, al, bh, bl, rh, rl) \
+	do { double s_, e_; TWO_SUM(ah, bh, s_, e_); \
+	     e_ += (al) + (bl); \
+	     QUICK_TWO_SUM(s_, e_, rh, rl); } while (0)
+
+/* iterate a point in double-double, like mandelbrot() in mslaved.c */
+
+static unsigned int dd_iterate(c_re_h, c_re_l, c_im_h, c_im_l,
+			       x_re_h, x_re_l, x_im_h, x_im_l, maxiter)
+double c_re_h, c_re_l, c_im_h, c_im_l;
+double x_re_h, x_re_l, x_im_h, x_im_l;
+unsigned int maxiter;
+{
+	double xresq_h, xresq_l, ximsq_h, ximsq_l, t_h, t_l;
+	unsigned int count = 0;
+	while (count < maxiter - 1) {
+		DD_MUL(x_re_h, x_re_l, x_re_h, x_re_l, xresq_h, xresq_l);
+		DD_MUL(x_im_h, x_im_l, x_im_h, x_im_l, ximsq_h, ximsq_l);
+		if (xresq_h + ximsq_h >= 4.0)
+			break;
+		DD_MUL(x_re_h, x_re_l, x_im_h, x_im_l, t_h, t_l);
+		DD_ADD(2.0 * t_h, 2.0 * t_l, c_im_h, c_im_l, x_im_h, x_im_l);
+		DD_ADD(xresq_h, xresq_l, -ximsq_h, -ximsq_l, t_h, t_l);
+		DD_ADD(t_h, t_l, c_re_h, c_re_l, x_re_h, x_re_l);
+		count++;
+	}
+	return count;
+}
+
+/* convert a to a "real", rounding toward minus infinity if fixed */
+
+#ifdef REAL_DOUBLE
+#define mp_to_real(a) mp_to_double(a)
+#else
+static real mp_to_real(a)
+mpfix *a;
+{
+	int n = a->limbs;
+	uint64 f = (uint64) a->l[n - 2] << MP_LIMB_BITS;
+	if (n > 2)
+		f |= a->l[n - 3];
+	return (((real) (sint32) a->l[n - 1] << REAL_RIGHTBITS) +
+		(real) (f >> (2 * MP_LIMB_BITS - REAL_RIGHTBITS)));
+}
+#endif
+
+/* convert a to a double-double (*hi, *lo) */
+
+static void mp_to_dd(a, hi, lo)
+mpfix *a;
+double *hi, *lo;
+{
+	mpfix t;
+	*hi = mp_to_double(a);
+	mp_from_double(&t, *hi, a->limbs);
+	mp_sub(&t, a, &t);
+	*lo = mp_to_double(&t);
+}
+
+/* the chunk being calculated */
+static int mp_precision;	/* PREC_MP, or a cheaper level of the ladder */
+static mpfix mp_vary_re, mp_vary_im;	/* the parameter varying by pixel */
+static mpfix mp_fixed_re, mp_fixed_im;	/* the other one */
+static mpfix mp_dx, mp_dy;	/* the pixel spacing */
+static int mp_julia;		/* true if z varies, false if c does */
+static unsigned int (*mp_kernel) ();
+static unsigned int mp_bytes;	/* bytes per count */
+static unsigned int mp_maxiter;
+static int mp_show_interior;
+
+/*
+  Set up for calculating the "w" by "h" chunk at (xmin, ymin) of an
+  MS_OPT_MP job, and pick the arithmetic to use.  Returns zero if the
+  job is not valid.
+*/
+
+static int mp_setup(mj, type, xmin, ymin, w, h, bytes_per_count, maxiter,
+		    show_interior)
+ms_mp_job *mj;
+int type;
+int xmin, ymin, w, h;
+unsigned int bytes_per_count;
+unsigned int maxiter;
+int show_interior;
+{
+	int limbs = ntohs(mj->limbs);
+	mpfix c_re, c_im, z0_re, z0_im, t;
+	double x, y, dx, dy, m;
+	unsigned int i;
+	int guard;
+
+	if (limbs < 2 || limbs > MS_MP_MAX_LIMBS || (limbs & 1) ||
+	    type > FRACTAL_JULIA)
+		return (0);
+	mp_kernel = mp_kernels[limbs / 2 - 1];
+
+	mp_from_net(&c_re, &mj->data[0], limbs);
+	mp_from_net(&c_im, &mj->data[limbs], limbs);
+	mp_from_net(&z0_re, &mj->data[2 * limbs], limbs);
+	mp_from_net(&z0_im, &mj->data[3 * limbs], limbs);
+	mp_from_net(&mp_dx, &mj->data[4 * limbs], limbs);
+	mp_from_net(&mp_dy, &mj->data[5 * limbs], limbs);
+
+	mp_julia = (type == FRACTAL_JULIA);
+	if (mp_julia) {
+		mp_vary_re = z0_re;	/* structure assignments */
+		mp_vary_im = z0_im;
+		mp_fixed_re = c_re;
+		mp_fixed_im = c_im;
+	} else {
+		mp_vary_re = c_re;
+		mp_vary_im = c_im;
+		mp_fixed_re = z0_re;
+		mp_fixed_im = z0_im;
+	}
+	/* take the chunk offset into account */
+	mp_mul_int(&t, &mp_dx, xmin);
+	mp_add(&mp_vary_re, &mp_vary_re, &t);
+	mp_mul_int(&t, &mp_dy, ymin);
+	mp_add(&mp_vary_im, &mp_vary_im, &t);
+
+	mp_bytes = bytes_per_count;
+	mp_maxiter = maxiter;
+	mp_show_interior = show_interior;
+
+	/*
+	   The precision ladder; cycle detection needs exact arithmetic.
+	   The error of a deep orbit can grow with every iteration, so
+	   these jobs, which are meant to be exact, also get a guard bit
+	   for each doubling of the iteration limit.
+	 */
+	mp_precision = PREC_MP;
+	if (ladder && !cycle_detect) {
+		for (guard = 0, i = maxiter; i > 1; i >>= 1)
+			guard++;
+		x = mp_to_double(&mp_vary_re);
+		y = mp_to_double(&mp_vary_im);
+		dx = mp_to_double(&mp_dx);
+		dy = mp_to_double(&mp_dy);
+		m = mp_to_double(&mp_fixed_re);
+		m = LARGER_ABS(0.0, m);
+		m = LARGER_ABS(m, mp_to_double(&mp_fixed_im));
+		m = LARGER_ABS(m, x);
+		m = LARGER_ABS(m, y);
+		m = LARGER_ABS(m, x + dx * (w - 1));
+		m = LARGER_ABS(m, y + dy * (h - 1));
+		if (real_precision_enough(guard, dx, m) &&
+		    real_precision_enough(guard, dy, m))
+			mp_precision = REAL_PRECISION;
+		else if (precision_enough(DOUBLE_DOUBLE_BITS - guard, dx, m) &&
+		    precision_enough(DOUBLE_DOUBLE_BITS - guard, dy, m))
+			mp_precision = PREC_DOUBLE_DOUBLE;
+	}
+	return (1);
+}
+
+/*
+  Calculate "n" pixels of the chunk starting at (x, y) and going right,
+  storing the counts at "out".  Returns the number of iterations done.
+*/
+
+static unsigned long mp_row(x, y, n, out)
+int x, y, n;
+char *out;
+{
+	mpfix re, im, t;
+	unsigned long mi_count = 0;
+	int i;
+
+	mp_mul_int(&t, &mp_dx, x);
+	mp_add(&re, &mp_vary_re, &t);
+	mp_mul_int(&t, &mp_dy, y);
+	mp_add(&im, &mp_vary_im, &t);
+	if (mp_precision == REAL_PRECISION) {
+		int vary = mp_julia ? 2 : 0;
+		real vy = mp_to_real(&im);
+		real f0 = mp_to_real(&mp_fixed_re);
+		real f1 = mp_to_real(&mp_fixed_im);
+		for (i = 0; i < n; i++) {
+			row_buf[vary][i] = mp_to_real(&re);
+			row_buf[vary + 1][i] = vy;
+			row_buf[2 - vary][i] = f0;
+			row_buf[3 - vary][i] = f1;
+			mp_add(&re, &re, &mp_dx);
+		}
+		mi_count = (*points_kernel) (n, row_buf[0], row_buf[1],
+					     row_buf[2], row_buf[3],
+					     row_counts, mp_maxiter);
+		for (i = 0; i < n; i++)
+			if (mp_bytes == 1)
+				STORE_8(out, i, row_counts[i]);
+			else
+				STORE_16(out, i, row_counts[i]);
+		return mi_count;
+	}
+	if (mp_precision == PREC_DOUBLE_DOUBLE) {
+		double vr_h, vr_l, vi_h, vi_l, f0_h, f0_l, f1_h, f1_l;
+		mp_to_dd(&im, &vi_h, &vi_l);
+		mp_to_dd(&mp_fixed_re, &f0_h, &f0_l);
+		mp_to_dd(&mp_fixed_im, &f1_h, &f1_l);
+		for (i = 0; i < n; i++) {
+			unsigned int count;
+			mp_to_dd(&re, &vr_h, &vr_l);
+			count = mp_julia ?
+			    dd_iterate(f0_h, f0_l, f1_h, f1_l,
+				       vr_h, vr_l, vi_h, vi_l, mp_maxiter) :
+			    dd_iterate(vr_h, vr_l, vi_h, vi_l,
+				       f0_h, f0_l, f1_h, f1_l, mp_maxiter);
+			if (mp_bytes == 1)
+				STORE_8(out, i, count);
+			else
+				STORE_16(out, i, count);
+			mi_count += count;
+			mp_add(&re, &re, &mp_dx);
+		}
+		return mi_count;
+	}
+	for (i = 0; i < n; i++) {
+		unsigned int count = mp_julia ?
+		    (*mp_kernel) (mp_fixed_re.l, mp_fixed_im.l, re.l, im.l,
+				  mp_maxiter, mp_show_interior) :
+		    (*mp_kernel) (re.l, im.l, mp_fixed_re.l, mp_fixed_im.l,
+				  mp_maxiter, mp_show_interior);
+		if (mp_bytes == 1)
+			STORE_8(out, i, count);
+		else
+			STORE_16(out, i, count);
+		mi_count += count;
+		mp_add(&re, &re, &mp_dx);
+	}
+	return mi_count;
+}
@@ -0,0 +1,134 @@
+/* ms_pack.c - packing the counts of a reply for the MandelSpawn server */
+
+/*
+    This file is part of MandelSpawn, a network Mandelbrot program.
+
+    Copyright (C) 1990-1993 Andreas Gustafsson
+
+    MandelSpawn is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License, version 1,
+    as published by the Free Software Foundation.
+
+    MandelSpawn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License,
+    version 1, along with this program; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+  This file is #included by mslaved.c.
+
+  A job with MS_OPT_PACK is calculated into pack_buf instead of the
+  reply, and pack_reply() then codes the counts into the reply as
+  described in ms_job.h.  Most of a typical picture is either inside
+  the set or in wide bands of equal count outside it, which come out
+  as a few run bytes, and the counts in between mostly differ from
+  their left neighbours by less than 64, which takes one byte.
+*/
+
+static uint16 pack_buf[MS_PACK_MAX_PIXELS];
+
+/* the i'th count in "counts" */
+#define PACK_COUNT(counts, bytes_per_count, i) ((bytes_per_count) == 1 ? \
+	(unsigned int) ((uint8 *) (counts))[i] : \
+	(unsigned int) ntohs(((uint16 *) (counts))[i]))
+
+/*
+  Code the "n" counts of "counts" as runs and deltas at "p", writing
+  no further than "end"; returns the end of the code, or a null
+  pointer if it didn't fit.
+*/
+
+static uint8 *pack_runs(counts, n, bytes_per_count, p, end)
+char *counts;
+unsigned int n;
+unsigned int bytes_per_count;
+uint8 *p, *end;
+{
+	unsigned int prev = 0, count, i = 0, j, u;
+	uint8 *token;
+	int d;
+
+	while (i < n) {
+		if (PACK_COUNT(counts, bytes_per_count, i) == prev) {
+			for (j = i + 1; j < n && j - i < MS_PACK_MAX_RUN &&
+			     PACK_COUNT(counts, bytes_per_count, j) == prev;
+			     j++)
+				;
+			if (p >= end)
+				return ((uint8 *) 0);
+			*p++ = j - i - 1;
+			i = j;
+			continue;
+		}
+		/* deltas until a run of at least two starts */
+		token = p++;
+		for (j = i; j < n && j - i < MS_PACK_MAX_DELTAS; j++) {
+			count = PACK_COUNT(counts, bytes_per_count, j);
+			if (count == prev && j + 1 < n &&
+			    PACK_COUNT(counts, bytes_per_count, j + 1) == prev)
+				break;
+			d = (int)count - (int)prev;
+			u = d >= 0 ? 2 * d : -2 * d - 1;
+			do {
+				if (p >= end)
+					return ((uint8 *) 0);
+				*p++ = (u & 0x7F) | (u > 0x7F ? 0x80 : 0);
+				u >>= 7;
+			} while (u);
+			prev = count;
+		}
+		*token = 0x80 | (j - i - 1);
+		i = j;
+	}
+	return (p);
+}
+
+/*
+  Code the "n" counts in pack_buf into the reply "out"; returns the
+  size of the reply.
+*/
+
+static unsigned int pack_reply(out, n, bytes_per_count)
+Message *out;
+unsigned int n;
+unsigned int bytes_per_count;
+{
+	ms_packed *h = (ms_packed *) & out->reply.data;
+	char *counts = (char *)pack_buf;
+	uint8 *data = (uint8 *) (h + 1);
+	uint8 *end = (uint8 *) out + MAX_DATAGRAM;
+	unsigned int raw = n * bytes_per_count;
+	unsigned int first, i;
+
+	first = n ? PACK_COUNT(counts, bytes_per_count, 0) : 0;
+	for (i = 1; i < n; i++)
+		if (PACK_COUNT(counts, bytes_per_count, i) != first)
+			break;
+	if (i >= n) {
+		h->encoding = htons(MS_PACK_UNIFORM);
+		h->value = htons(first);
+		return ((char *)data - (char *)out);
+	}
+	/* it is only worth it if shorter than the counts as such */
+	if (raw < (unsigned)(end - data))
+		end = data + raw;
+	if ((end = pack_runs(counts, n, bytes_per_count, data, end))) {
+		h->encoding = htons(MS_PACK_RUNS);
+		h->value = htons(end - data);
+		return ((char *)end - (char *)out);
+	}
+	if (raw <= (unsigned)((uint8 *) out + MAX_DATAGRAM - data)) {
+		h->encoding = htons(MS_PACK_RAW);
+		h->value = 0;
+		bcopy(counts, (char *)data, raw);
+		return ((char *)data + raw - (char *)out);
+	}
+	h->encoding = htons(MS_PACK_SPLIT);
+	h->value = 0;
+	return ((char *)data - (char *)out);
+}
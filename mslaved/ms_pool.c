@@ -0,0 +1,233 @@
+/* ms_pool.c - worker threads for the MandelSpawn computation server */
+
+/*
+    This file is part of MandelSpawn, a network Mandelbrot program.
+
+    Copyright (C) 1990-1993 Andreas Gustafsson
+
+    MandelSpawn is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License, version 1,
+    as published by the Free Software Foundation.
+
+    MandelSpawn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License,
+    version 1, along with this program; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+  This file is #included by mslaved.c.
+
+  On a multiprocessor, the rows of each chunk are shared out among a
+  pool of threads so that a single server keeps all the processors
+  busy.  Each thread starts on its own contiguous range of rows and
+  takes them one at a time from the top.  A thread that runs out of
+  rows steals the second half of the largest range left to another
+  thread, so all of them finish the chunk at about the same time no
+  matter how unevenly the work is spread over its rows.
+
+  The rows are grouped in blocks of POOL_BLOCK, and the ranges are
+  only ever cut between blocks, so each block is calculated in order
+  by a single thread.  The "last row reached the limit" flag for
+  periodicity checking is carried from one row to the next within a
+  block and cleared at the start of each, in the single-threaded loop
+  as well.  Since periodicity checking can change a count, this makes
+  the counts of a chunk the same however many threads there are and
+  however the rows happen to be shared out among them.
+
+  The calling thread works on the first range itself; the others
+  sleep between chunks.  Everything a row function writes other than
+  its own row of the reply must be THREAD_LOCAL.  Between its rows,
+  the calling thread also calls a function that can abort the chunk,
+  after which no thread starts another row.
+
+  Without HAVE_PTHREADS, or with one thread, pool_rows() is just the
+  single-threaded loop.
+*/
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+#define MAX_THREADS 256
+
+int n_threads = 0;		/* number of threads; 0 means one per CPU */
+
+#define POOL_BLOCK 4		/* rows that go together; see above */
+
+/*
+  The row function of the chunk being calculated: it does row "y" of
+  the chunk and returns the number of iterations.  "*limit_seen" is
+  set if the previous row reached the iteration limit, and the
+  function should set it for the next row.
+*/
+static unsigned long (*pool_row) ();
+
+/* returns true if the chunk is to be abandoned; called between rows */
+static int (*pool_poll) ();
+
+#ifdef HAVE_PTHREADS
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned int pool_generation;	/* serial no. of the current chunk */
+static int pool_busy;		/* helpers still working on it */
+static int pool_aborted;	/* true if the chunk has been abandoned */
+static int pool_lo[MAX_THREADS], pool_hi[MAX_THREADS];	/* rows left */
+static unsigned long pool_mi_count;
+
+/* Calculate rows as thread "me" until there are none left to take */
+
+static void pool_work(me)
+int me;
+{
+	unsigned long mi_count = 0;
+	int limit_seen = 0;
+	int y, i, victim, mid;
+
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		if (pool_aborted)
+			break;
+		if (pool_lo[me] < pool_hi[me]) {
+			y = pool_lo[me]++;
+			pthread_mutex_unlock(&pool_lock);
+			if (y % POOL_BLOCK == 0)
+				limit_seen = 0;
+			mi_count += (*pool_row) (y, &limit_seen);
+			if (me == 0 && (*pool_poll) ()) {
+				pthread_mutex_lock(&pool_lock);
+				pool_aborted = 1;
+				break;
+			}
+			pthread_mutex_lock(&pool_lock);
+			continue;
+		}
+		victim = -1;
+		for (i = 0; i < n_threads; i++)
+			if (pool_lo[i] < pool_hi[i] && (victim < 0 ||
+			    pool_hi[i] - pool_lo[i] >
+			    pool_hi[victim] - pool_lo[victim]))
+				victim = i;
+		if (victim < 0)
+			break;
+		/* the first block boundary past the middle, or past the row
+		   the victim is on */
+		mid = pool_lo[victim] + (pool_hi[victim] - pool_lo[victim]) / 2;
+		mid = (mid + POOL_BLOCK - 1) / POOL_BLOCK * POOL_BLOCK;
+		if (mid >= pool_hi[victim])
+			mid = (pool_lo[victim] / POOL_BLOCK + 1) * POOL_BLOCK;
+		if (mid >= pool_hi[victim])
+			break;	/* what is left is in blocks already begun */
+		pool_lo[me] = mid;
+		pool_hi[me] = pool_hi[victim];
+		pool_hi[victim] = mid;
+	}
+	pool_mi_count += mi_count;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static void *pool_thread(arg)
+void *arg;
+{
+	int me = (int)(long)arg;
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (pool_generation == seen)
+			pthread_cond_wait(&pool_start, &pool_lock);
+		seen = pool_generation;
+		pthread_mutex_unlock(&pool_lock);
+		pool_work(me);
+		pthread_mutex_lock(&pool_lock);
+		if (--pool_busy == 0)
+			pthread_cond_signal(&pool_done);
+	}
+	/* NOTREACHED */
+	return ((void *)0);
+}
+
+#endif /* HAVE_PTHREADS */
+
+/* Start the worker threads; called once the nice value has been set */
+
+void pool_init()
+{
+#ifdef HAVE_PTHREADS
+	pthread_t thread;
+	int i;
+
+	if (n_threads <= 0)
+		n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads > MAX_THREADS)
+		n_threads = MAX_THREADS;
+	for (i = 1; i < n_threads; i++)
+		if (pthread_create(&thread, (pthread_attr_t *) 0, pool_thread,
+				   (void *)(long)i) != 0)
+			break;
+	n_threads = i;		/* whatever we got */
+#else
+	n_threads = 1;
+#endif
+}
+
+/*
+  Calculate the "n" rows of a chunk with the function "row", calling
+  "poll" between rows (see pool_row and pool_poll above); returns the
+  total number of iterations.
+*/
+
+static unsigned long pool_rows(n, row, poll)
+int n;
+unsigned long (*row) ();
+int (*poll) ();
+{
+	unsigned long mi_count = 0;
+	int limit_seen = 0;
+	int y;
+
+	pool_row = row;
+	pool_poll = poll;
+#ifdef HAVE_PTHREADS
+	if (n_threads > 1 && n > 1) {
+		int i;
+		pthread_mutex_lock(&pool_lock);
+		for (i = 0; i < n_threads; i++)
+			pool_lo[i] = (int)((long)n * i / n_threads) /
+			    POOL_BLOCK * POOL_BLOCK;
+		for (i = 0; i < n_threads; i++)
+			pool_hi[i] = i + 1 < n_threads ? pool_lo[i + 1] : n;
+		pool_mi_count = 0;
+		pool_aborted = 0;
+		pool_busy = n_threads - 1;
+		pool_generation++;
+		pthread_cond_broadcast(&pool_start);
+		pthread_mutex_unlock(&pool_lock);
+		pool_work(0);
+		pthread_mutex_lock(&pool_lock);
+		while (pool_busy > 0)
+			pthread_cond_wait(&pool_done, &pool_lock);
+		mi_count = pool_mi_count;
+		pthread_mutex_unlock(&pool_lock);
+		return (mi_count);
+	}
+#endif
+	for (y = 0; y < n; y++) {
+		if (y % POOL_BLOCK == 0)
+			limit_seen = 0;
+		mi_count += (*pool_row) (y, &limit_seen);
+		if ((*pool_poll) ())
+			break;
+	}
+	return (mi_count);
+}
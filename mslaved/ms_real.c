@@ -19,6 +19,19 @@
     Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+/*
+  A fused multiply-add rounds only once, so letting the compiler
+  contract "x*y + c" would make the vector and scalar kernels (and
+  different servers) disagree about some pixels.  Forbid it.
+*/
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#else
+#ifdef __GNUC__
+#pragma GCC optimize ("fp-contract=off")
+#endif
+#endif
+
 #ifdef REAL_FIXED
 #ifdef lint			/* lint doesn't like asm's; fake it */
 static inline unsigned long fracmult(x, y)
@@ -127,3 +140,24 @@ register long x, y;
 #endif				/* not mips */
 #endif				/* not lint */
 #endif				/* REAL_FIXED */
+
+#ifdef REAL_FIXED64
+/*
+  The 128-bit product is formed by the compiler, which is a single
+  widening multiply (or a multiply and a "multiply high") on 64-bit
+  processors.  Like the 32-bit versions above, these round toward
+  minus infinity.
+*/
+
+static inline sint64 fracmult(x, y)
+sint64 x, y;
+{
+	return ((sint64) (((__int128) x * y) >> REAL_RIGHTBITS));
+}
+
+static inline sint64 fracmult2(x, y)
+sint64 x, y;
+{
+	return ((sint64) (((__int128) x * y) >> (REAL_RIGHTBITS - 1)));
+}
+#endif				/* REAL_FIXED64 */
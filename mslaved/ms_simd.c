@@ -0,0 +1,724 @@
+/* ms_simd.c - vectorized iteration kernels for the computation server */
+
+/*
+    This file is part of MandelSpawn, a network Mandelbrot program.
+
+    Copyright (C) 1990-1993 Andreas Gustafsson
+
+    MandelSpawn is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License, version 1,
+    as published by the Free Software Foundation.
+
+    MandelSpawn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License,
+    version 1, along with this program; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+  The kernels in this file iterate 2, 4 or 8 pixels at a time using
+  the vector units of modern processors (SSE2, AVX2 and AVX-512 on
+  x86-64, NEON on 64-bit ARM), or twice as many in single precision.
+  Each kernel takes a list of points and stores the iteration count
+  of each point in "counts"; lanes whose points have escaped are
+  masked off while the others go on iterating.  The arithmetic is
+  exactly that of mandelbrot() in mslaved.c, operation for operation
+  (see the note about contraction in ms_real.c), so the counts are
+  identical to those of the scalar kernel.
+
+  The single-precision kernels do the same in floats; calculate()
+  uses them only for chunks where a float is accurate enough.
+
+  The other fractal types (see ms_job.h) have kernels of their own,
+  in double precision only, generated from the same body with a
+  different step.  Each has a portable scalar version that does the
+  same operations in the same order, so again the counts don't
+  depend on the kernel used.
+
+  The kernels require GCC (or a compiler that pretends to be GCC)
+  and are used only when the "real" type is a C double.  Which of
+  them to use is decided at run time by simd_init(), so that one
+  binary can run on any processor of the family it was compiled for.
+*/
+
+#if defined(__GNUC__) && defined(REAL_DOUBLE) && !defined(NO_SIMD)
+#if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#if defined(__x86_64__)
+#define SIMD_X86
+#endif
+#if defined(__aarch64__)
+#define SIMD_NEON
+#endif
+#endif
+#endif
+
+/*
+  The scalar fallback: iterate the points one at a time using the
+  portable kernel in mslaved.c.  Returns the total number of
+  iterations done.  Like all the kernels, it leaves the final z of
+  each point in z_re and z_im (see state_chunk() in mslaved.c).
+*/
+
+static unsigned long scalar_points(n, c_re, c_im, z_re, z_im, counts,
+				   maxiter)
+int n;
+real *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+{
+	unsigned long mi_count = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		counts[i] = mandelbrot_z(c_re[i], c_im[i], &z_re[i], &z_im[i],
+					 maxiter, 0, 0);
+		mi_count += counts[i];
+	}
+	return mi_count;
+}
+
+/*
+  The scalar kernels of the other fractal types.  FORMULA_ESCAPED()
+  is the escape test made before each step and FORMULA_STEP() the
+  step from (zr, zi) to (nr, ni).  The Multibrot escape test looks
+  at the coordinates first, so that the squares can't overflow in
+  fixed point; with doubles it gives the same result as the test in
+  the vector kernels.
+*/
+
+#define ABS_REAL(x) (gteq_real(x, zero_real()) ? (x) : sub_real(zero_real(), x))
+
+#define ESCAPED_QUADRATIC(zr, zi) \
+	gteq_real(add_real(mul_real(zr, zr), mul_real(zi, zi)), four_real())
+#define ESCAPED_POWER(zr, zi) \
+	(gteq_real(ABS_REAL(zr), int_to_real(2)) || \
+	 gteq_real(ABS_REAL(zi), int_to_real(2)) || \
+	 ESCAPED_QUADRATIC(zr, zi))
+#define ESCAPED_HENON(zr, zi) gteq_real(ABS_REAL(zr), int_to_real(10))
+
+#define STEP_SHIP(zr, zi, cr, ci, nr, ni) \
+	do { \
+		nr = add_real(sub_real(mul_real(zr, zr), mul_real(zi, zi)), cr); \
+		ni = add_real(twice_mul_real(ABS_REAL(zr), ABS_REAL(zi)), ci); \
+	} while (0)
+#define STEP_POWER(D, zr, zi, cr, ci, nr, ni) \
+	do { \
+		real w_re = zr, w_im = zi, t; \
+		int k; \
+		for (k = 1; k < (D); k++) { \
+			t = sub_real(mul_real(w_re, zr), mul_real(w_im, zi)); \
+			w_im = add_real(mul_real(w_re, zi), mul_real(w_im, zr)); \
+			w_re = t; \
+		} \
+		nr = add_real(w_re, cr); \
+		ni = add_real(w_im, ci); \
+	} while (0)
+#define STEP_POWER3(zr, zi, cr, ci, nr, ni) STEP_POWER(3, zr, zi, cr, ci, nr, ni)
+#define STEP_POWER4(zr, zi, cr, ci, nr, ni) STEP_POWER(4, zr, zi, cr, ci, nr, ni)
+#define STEP_POWER5(zr, zi, cr, ci, nr, ni) STEP_POWER(5, zr, zi, cr, ci, nr, ni)
+#define STEP_HENON(zr, zi, cr, ci, nr, ni) \
+	do { \
+		nr = add_real(one_real(), add_real(mul_real(cr, zi), \
+				mul_real(ci, mul_real(zr, zr)))); \
+		ni = zr; \
+	} while (0)
+
+#define SCALAR_FORMULA(name, ESCAPED, STEP) \
+static unsigned long name(n, c_re, c_im, z_re, z_im, counts, maxiter) \
+int n; \
+real *c_re, *c_im, *z_re, *z_im; \
+unsigned int *counts; \
+unsigned int maxiter; \
+{ \
+	unsigned long mi_count = 0; \
+	int i; \
+	for (i = 0; i < n; i++) { \
+		real zr = z_re[i], zi = z_im[i], nr, ni; \
+		unsigned int count = 0; \
+		while (count < maxiter - 1) { \
+			if (ESCAPED(zr, zi)) \
+				break; \
+			STEP(zr, zi, c_re[i], c_im[i], nr, ni); \
+			zr = nr; \
+			zi = ni; \
+			count++; \
+		} \
+		counts[i] = count; \
+		z_re[i] = zr; \
+		z_im[i] = zi; \
+		mi_count += count; \
+	} \
+	return mi_count; \
+}
+
+SCALAR_FORMULA(scalar_henon_points, ESCAPED_HENON, STEP_HENON)
+SCALAR_FORMULA(scalar_multibrot3_points, ESCAPED_POWER, STEP_POWER3)
+SCALAR_FORMULA(scalar_multibrot4_points, ESCAPED_POWER, STEP_POWER4)
+SCALAR_FORMULA(scalar_multibrot5_points, ESCAPED_POWER, STEP_POWER5)
+SCALAR_FORMULA(scalar_ship_points, ESCAPED_QUADRATIC, STEP_SHIP)
+
+#ifdef REAL_DOUBLE
+/*
+  The same in single precision.  The points are given as floats;
+  mandelbrot() can't be used since "real" is a double.
+*/
+
+static unsigned long scalar_points_float(n, c_re, c_im, z_re, z_im, counts,
+					 maxiter)
+int n;
+float *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+{
+	unsigned long mi_count = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		float x_re = z_re[i], x_im = z_im[i], xresq, ximsq;
+		unsigned int count = 0;
+		while (count < maxiter - 1) {
+			xresq = x_re * x_re;
+			ximsq = x_im * x_im;
+			if (xresq + ximsq >= 4.0f)
+				break;
+			x_im = x_re * x_im * 2.0f + c_im[i];
+			x_re = xresq - ximsq + c_re[i];
+			count++;
+		}
+		counts[i] = count;
+		z_re[i] = x_re;
+		z_im[i] = x_im;
+		mi_count += count;
+	}
+	return mi_count;
+}
+#endif				/* REAL_DOUBLE */
+
+#if defined(SIMD_X86) || defined(SIMD_NEON)
+
+/*
+  The body of a vector kernel, written in terms of the V_ and M_
+  macros defined before each instantiation below.  V_T is a vector
+  of LANES elements of type T (double or float) and M_T the
+  corresponding lane mask.  The iteration counts are kept in a vector
+  of the same type, which is exact for any count that fits in a reply
+  message.
+
+  Lanes that have escaped keep being iterated along with the rest
+  (their values may overflow, which is harmless); they just stop
+  being counted; the final z of each point is stored back in z_re
+  and z_im.  Since the counts are masked per lane anyway, the
+  test for all lanes having escaped is made only once every
+  ESCAPE_BATCH iterations (see mandelbrot() in mslaved.c); the few
+  extra iterations change nothing.  A partial group at the end of
+  the list is padded by repeating its last point.  "STEP" is one of
+  the SIMD_STEP_ macros, which do the same operations as the scalar
+  kernels; V_ABS is needed only by the double-precision ones.
+*/
+
+#define SIMD_STEP_MANDELBROT \
+	do { \
+		V_T xresq = V_MUL(x_re, x_re); \
+		V_T ximsq = V_MUL(x_im, x_im); \
+		active = M_ANDNOT(M_GE(V_ADD(xresq, ximsq), V_SET1(4.0)), \
+				  active); \
+		x_im = V_ADD(V_MUL(V_MUL(x_re, x_im), V_SET1(2.0)), c_im_v); \
+		x_re = V_ADD(V_SUB(xresq, ximsq), c_re_v); \
+		count = V_INC(count, active, one); \
+	} while (0)
+
+#define SIMD_STEP_SHIP \
+	do { \
+		V_T xresq = V_MUL(x_re, x_re); \
+		V_T ximsq = V_MUL(x_im, x_im); \
+		active = M_ANDNOT(M_GE(V_ADD(xresq, ximsq), V_SET1(4.0)), \
+				  active); \
+		x_im = V_ADD(V_MUL(V_MUL(V_ABS(x_re), V_ABS(x_im)), \
+				   V_SET1(2.0)), c_im_v); \
+		x_re = V_ADD(V_SUB(xresq, ximsq), c_re_v); \
+		count = V_INC(count, active, one); \
+	} while (0)
+
+#define SIMD_STEP_POWER(D) \
+	do { \
+		V_T w_re = x_re; \
+		V_T w_im = x_im; \
+		V_T t; \
+		int k; \
+		active = M_ANDNOT(M_GE(V_ADD(V_MUL(x_re, x_re), \
+					     V_MUL(x_im, x_im)), V_SET1(4.0)), \
+				  active); \
+		for (k = 1; k < (D); k++) { \
+			t = V_SUB(V_MUL(w_re, x_re), V_MUL(w_im, x_im)); \
+			w_im = V_ADD(V_MUL(w_re, x_im), V_MUL(w_im, x_re)); \
+			w_re = t; \
+		} \
+		x_re = V_ADD(w_re, c_re_v); \
+		x_im = V_ADD(w_im, c_im_v); \
+		count = V_INC(count, active, one); \
+	} while (0)
+
+#define SIMD_STEP_HENON \
+	do { \
+		V_T t; \
+		active = M_ANDNOT(M_GE(V_ABS(x_re), V_SET1(10.0)), active); \
+		t = V_ADD(one, V_ADD(V_MUL(c_re_v, x_im), \
+				     V_MUL(c_im_v, V_MUL(x_re, x_re)))); \
+		x_im = x_re; \
+		x_re = t; \
+		count = V_INC(count, active, one); \
+	} while (0)
+
+#define SIMD_POINTS_BODY(T, LANES, STEP) \
+{ \
+	T cr[LANES], ci[LANES], zr[LANES], zi[LANES], cnt[LANES]; \
+	unsigned long mi_count = 0; \
+	unsigned int limit = maxiter - 1; \
+	int i, l; \
+	for (i = 0; i < n; i += LANES) { \
+		V_T x_re, x_im, c_re_v, c_im_v; \
+		V_T one = V_SET1(1.0), count = V_SET1(0.0); \
+		M_T active = M_ALL; \
+		unsigned int it, b; \
+		for (l = 0; l < LANES; l++) { \
+			int k = (i + l < n) ? i + l : n - 1; \
+			cr[l] = c_re[k]; \
+			ci[l] = c_im[k]; \
+			zr[l] = z_re[k]; \
+			zi[l] = z_im[k]; \
+		} \
+		c_re_v = V_LOAD(cr); \
+		c_im_v = V_LOAD(ci); \
+		x_re = V_LOAD(zr); \
+		x_im = V_LOAD(zi); \
+		for (it = 0; it + ESCAPE_BATCH <= limit; it += ESCAPE_BATCH) { \
+			for (b = 0; b < ESCAPE_BATCH; b++) \
+				STEP; \
+			if (M_NONE(active)) \
+				break; \
+		} \
+		for (; it < limit && !M_NONE(active); it++) \
+			STEP; \
+		V_STORE(cnt, count); \
+		V_STORE(zr, x_re); \
+		V_STORE(zi, x_im); \
+		for (l = 0; l < LANES && i + l < n; l++) { \
+			counts[i + l] = (unsigned int)cnt[l]; \
+			z_re[i + l] = zr[l]; \
+			z_im[i + l] = zi[l]; \
+			mi_count += counts[i + l]; \
+		} \
+	} \
+	return mi_count; \
+}
+
+/* a double-precision kernel for one of the other fractal types */
+#define SIMD_KERNEL(name, ATTR, LANES, STEP) \
+ATTR \
+static unsigned long name(n, c_re, c_im, z_re, z_im, counts, maxiter) \
+int n; \
+real *c_re, *c_im, *z_re, *z_im; \
+unsigned int *counts; \
+unsigned int maxiter; \
+SIMD_POINTS_BODY(double, LANES, STEP)
+
+/* all of them for one instruction set */
+#define SIMD_FORMULA_KERNELS(isa, ATTR, LANES) \
+SIMD_KERNEL(isa##_henon_points, ATTR, LANES, SIMD_STEP_HENON) \
+SIMD_KERNEL(isa##_multibrot3_points, ATTR, LANES, SIMD_STEP_POWER(3)) \
+SIMD_KERNEL(isa##_multibrot4_points, ATTR, LANES, SIMD_STEP_POWER(4)) \
+SIMD_KERNEL(isa##_multibrot5_points, ATTR, LANES, SIMD_STEP_POWER(5)) \
+SIMD_KERNEL(isa##_ship_points, ATTR, LANES, SIMD_STEP_SHIP)
+
+#endif				/* SIMD_X86 || SIMD_NEON */
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+
+/* SSE2: two lanes; always present on x86-64 */
+
+#define V_T		__m128d
+#define M_T		__m128d
+#define V_SET1(x)	_mm_set1_pd(x)
+#define V_LOAD(p)	_mm_loadu_pd(p)
+#define V_STORE(p,v)	_mm_storeu_pd(p, v)
+#define V_ADD(a,b)	_mm_add_pd(a, b)
+#define V_SUB(a,b)	_mm_sub_pd(a, b)
+#define V_MUL(a,b)	_mm_mul_pd(a, b)
+#define V_INC(c,m,one)	_mm_add_pd(c, _mm_and_pd(m, one))
+#define M_ALL		_mm_castsi128_pd(_mm_set1_epi32(-1))
+#define M_GE(a,b)	_mm_cmpge_pd(a, b)
+#define M_ANDNOT(e,m)	_mm_andnot_pd(e, m)
+#define M_NONE(m)	(_mm_movemask_pd(m) == 0)
+
+static unsigned long sse2_points(n, c_re, c_im, z_re, z_im, counts,
+				 maxiter)
+int n;
+real *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(double, 2, SIMD_STEP_MANDELBROT)
+
+#define V_ABS(a)	_mm_andnot_pd(_mm_set1_pd(-0.0), a)
+SIMD_FORMULA_KERNELS(sse2, , 2)
+#undef V_ABS
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+
+/* AVX2: four lanes */
+
+#define V_T		__m256d
+#define M_T		__m256d
+#define V_SET1(x)	_mm256_set1_pd(x)
+#define V_LOAD(p)	_mm256_loadu_pd(p)
+#define V_STORE(p,v)	_mm256_storeu_pd(p, v)
+#define V_ADD(a,b)	_mm256_add_pd(a, b)
+#define V_SUB(a,b)	_mm256_sub_pd(a, b)
+#define V_MUL(a,b)	_mm256_mul_pd(a, b)
+#define V_INC(c,m,one)	_mm256_add_pd(c, _mm256_and_pd(m, one))
+#define M_ALL		_mm256_castsi256_pd(_mm256_set1_epi32(-1))
+#define M_GE(a,b)	_mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define M_ANDNOT(e,m)	_mm256_andnot_pd(e, m)
+#define M_NONE(m)	(_mm256_movemask_pd(m) == 0)
+
+__attribute__ ((target("avx2")))
+static unsigned long avx2_points(n, c_re, c_im, z_re, z_im, counts,
+				 maxiter)
+int n;
+real *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(double, 4, SIMD_STEP_MANDELBROT)
+
+#define V_ABS(a)	_mm256_andnot_pd(_mm256_set1_pd(-0.0), a)
+SIMD_FORMULA_KERNELS(avx2, __attribute__ ((target("avx2"))), 4)
+#undef V_ABS
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+
+/* AVX-512: eight lanes, with real mask registers */
+
+#define V_T		__m512d
+#define M_T		__mmask8
+#define V_SET1(x)	_mm512_set1_pd(x)
+#define V_LOAD(p)	_mm512_loadu_pd(p)
+#define V_STORE(p,v)	_mm512_storeu_pd(p, v)
+#define V_ADD(a,b)	_mm512_add_pd(a, b)
+#define V_SUB(a,b)	_mm512_sub_pd(a, b)
+#define V_MUL(a,b)	_mm512_mul_pd(a, b)
+#define V_INC(c,m,one)	_mm512_mask_add_pd(c, m, c, one)
+#define M_ALL		((__mmask8) 0xFF)
+#define M_GE(a,b)	_mm512_cmp_pd_mask(a, b, _CMP_GE_OQ)
+#define M_ANDNOT(e,m)	((__mmask8) ((m) & ~(e)))
+#define M_NONE(m)	((m) == 0)
+
+__attribute__ ((target("avx512f")))
+static unsigned long avx512_points(n, c_re, c_im, z_re, z_im, counts,
+				   maxiter)
+int n;
+real *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(double, 8, SIMD_STEP_MANDELBROT)
+
+#define V_ABS(a)	_mm512_abs_pd(a)
+SIMD_FORMULA_KERNELS(avx512, __attribute__ ((target("avx512f"))), 8)
+#undef V_ABS
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+
+/* the same in single precision: four, eight and sixteen lanes */
+
+#define V_T		__m128
+#define M_T		__m128
+#define V_SET1(x)	_mm_set1_ps(x)
+#define V_LOAD(p)	_mm_loadu_ps(p)
+#define V_STORE(p,v)	_mm_storeu_ps(p, v)
+#define V_ADD(a,b)	_mm_add_ps(a, b)
+#define V_SUB(a,b)	_mm_sub_ps(a, b)
+#define V_MUL(a,b)	_mm_mul_ps(a, b)
+#define V_INC(c,m,one)	_mm_add_ps(c, _mm_and_ps(m, one))
+#define M_ALL		_mm_castsi128_ps(_mm_set1_epi32(-1))
+#define M_GE(a,b)	_mm_cmpge_ps(a, b)
+#define M_ANDNOT(e,m)	_mm_andnot_ps(e, m)
+#define M_NONE(m)	(_mm_movemask_ps(m) == 0)
+
+static unsigned long sse2_points_float(n, c_re, c_im, z_re, z_im, counts,
+				       maxiter)
+int n;
+float *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(float, 4, SIMD_STEP_MANDELBROT)
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+
+#define V_T		__m256
+#define M_T		__m256
+#define V_SET1(x)	_mm256_set1_ps(x)
+#define V_LOAD(p)	_mm256_loadu_ps(p)
+#define V_STORE(p,v)	_mm256_storeu_ps(p, v)
+#define V_ADD(a,b)	_mm256_add_ps(a, b)
+#define V_SUB(a,b)	_mm256_sub_ps(a, b)
+#define V_MUL(a,b)	_mm256_mul_ps(a, b)
+#define V_INC(c,m,one)	_mm256_add_ps(c, _mm256_and_ps(m, one))
+#define M_ALL		_mm256_castsi256_ps(_mm256_set1_epi32(-1))
+#define M_GE(a,b)	_mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define M_ANDNOT(e,m)	_mm256_andnot_ps(e, m)
+#define M_NONE(m)	(_mm256_movemask_ps(m) == 0)
+
+__attribute__ ((target("avx2")))
+static unsigned long avx2_points_float(n, c_re, c_im, z_re, z_im, counts,
+				       maxiter)
+int n;
+float *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(float, 8, SIMD_STEP_MANDELBROT)
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+
+#define V_T		__m512
+#define M_T		__mmask16
+#define V_SET1(x)	_mm512_set1_ps(x)
+#define V_LOAD(p)	_mm512_loadu_ps(p)
+#define V_STORE(p,v)	_mm512_storeu_ps(p, v)
+#define V_ADD(a,b)	_mm512_add_ps(a, b)
+#define V_SUB(a,b)	_mm512_sub_ps(a, b)
+#define V_MUL(a,b)	_mm512_mul_ps(a, b)
+#define V_INC(c,m,one)	_mm512_mask_add_ps(c, m, c, one)
+#define M_ALL		((__mmask16) 0xFFFF)
+#define M_GE(a,b)	_mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#define M_ANDNOT(e,m)	((__mmask16) ((m) & ~(e)))
+#define M_NONE(m)	((m) == 0)
+
+__attribute__ ((target("avx512f")))
+static unsigned long avx512_points_float(n, c_re, c_im, z_re, z_im, counts,
+					 maxiter)
+int n;
+float *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(float, 16, SIMD_STEP_MANDELBROT)
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+#endif				/* SIMD_X86 */
+
+#ifdef SIMD_NEON
+#include <arm_neon.h>
+
+/* NEON: two lanes; always present on 64-bit ARM */
+
+#define V_T		float64x2_t
+#define M_T		uint64x2_t
+#define V_SET1(x)	vdupq_n_f64(x)
+#define V_LOAD(p)	vld1q_f64(p)
+#define V_STORE(p,v)	vst1q_f64(p, v)
+#define V_ADD(a,b)	vaddq_f64(a, b)
+#define V_SUB(a,b)	vsubq_f64(a, b)
+#define V_MUL(a,b)	vmulq_f64(a, b)
+#define V_INC(c,m,one)	vaddq_f64(c, vreinterpretq_f64_u64( \
+				vandq_u64(m, vreinterpretq_u64_f64(one))))
+#define M_ALL		vdupq_n_u64(~(uint64_t) 0)
+#define M_GE(a,b)	vcgeq_f64(a, b)
+#define M_ANDNOT(e,m)	vbicq_u64(m, e)
+#define M_NONE(m)	((vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) == 0)
+
+static unsigned long neon_points(n, c_re, c_im, z_re, z_im, counts,
+				 maxiter)
+int n;
+real *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(double, 2, SIMD_STEP_MANDELBROT)
+
+#define V_ABS(a)	vabsq_f64(a)
+SIMD_FORMULA_KERNELS(neon, , 2)
+#undef V_ABS
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+
+/* the same in single precision: four lanes */
+
+#define V_T		float32x4_t
+#define M_T		uint32x4_t
+#define V_SET1(x)	vdupq_n_f32(x)
+#define V_LOAD(p)	vld1q_f32(p)
+#define V_STORE(p,v)	vst1q_f32(p, v)
+#define V_ADD(a,b)	vaddq_f32(a, b)
+#define V_SUB(a,b)	vsubq_f32(a, b)
+#define V_MUL(a,b)	vmulq_f32(a, b)
+#define V_INC(c,m,one)	vaddq_f32(c, vreinterpretq_f32_u32( \
+				vandq_u32(m, vreinterpretq_u32_f32(one))))
+#define M_ALL		vdupq_n_u32(~(uint32_t) 0)
+#define M_GE(a,b)	vcgeq_f32(a, b)
+#define M_ANDNOT(e,m)	vbicq_u32(m, e)
+#define M_NONE(m)	(vmaxvq_u32(m) == 0)
+
+static unsigned long neon_points_float(n, c_re, c_im, z_re, z_im, counts,
+				       maxiter)
+int n;
+float *c_re, *c_im, *z_re, *z_im;
+unsigned int *counts;
+unsigned int maxiter;
+SIMD_POINTS_BODY(float, 4, SIMD_STEP_MANDELBROT)
+
+#undef V_T
+#undef M_T
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_INC
+#undef M_ALL
+#undef M_GE
+#undef M_ANDNOT
+#undef M_NONE
+#endif				/* SIMD_NEON */
+
+/* the kernels chosen by simd_init(), and their name for diagnostics */
+unsigned long (*points_kernel) () = scalar_points;
+#ifdef REAL_DOUBLE
+unsigned long (*points_kernel_float) () = scalar_points_float;
+#endif
+unsigned long (*henon_kernel) () = scalar_henon_points;
+unsigned long (*multibrot3_kernel) () = scalar_multibrot3_points;
+unsigned long (*multibrot4_kernel) () = scalar_multibrot4_points;
+unsigned long (*multibrot5_kernel) () = scalar_multibrot5_points;
+unsigned long (*ship_kernel) () = scalar_ship_points;
+char *points_kernel_name = "scalar";
+
+/*
+  Pick the widest kernel supported by the processor we are running
+  on, unless "force_scalar" is set.  The vector kernels don't do
+  cycle detection; the row loops that need it don't use them.
+*/
+
+#define SET_FORMULA_KERNELS(isa) \
+	do { \
+		henon_kernel = isa##_henon_points; \
+		multibrot3_kernel = isa##_multibrot3_points; \
+		multibrot4_kernel = isa##_multibrot4_points; \
+		multibrot5_kernel = isa##_multibrot5_points; \
+		ship_kernel = isa##_ship_points; \
+	} while (0)
+
+void simd_init(force_scalar)
+int force_scalar;
+{
+	if (force_scalar)
+		return;
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		points_kernel = avx512_points;
+		points_kernel_float = avx512_points_float;
+		points_kernel_name = "avx512";
+		SET_FORMULA_KERNELS(avx512);
+	} else if (__builtin_cpu_supports("avx2")) {
+		points_kernel = avx2_points;
+		points_kernel_float = avx2_points_float;
+		points_kernel_name = "avx2";
+		SET_FORMULA_KERNELS(avx2);
+	} else {
+		points_kernel = sse2_points;
+		points_kernel_float = sse2_points_float;
+		points_kernel_name = "sse2";
+		SET_FORMULA_KERNELS(sse2);
+	}
+#endif
+#ifdef SIMD_NEON
+	points_kernel = neon_points;
+	points_kernel_float = neon_points_float;
+	points_kernel_name = "neon";
+	SET_FORMULA_KERNELS(neon);
+#endif
+}
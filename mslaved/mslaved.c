@@ -19,11 +19,17 @@
     Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#if defined(HAVE_MMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for recvmmsg() */
+#endif
+
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <signal.h>
+#include <sys/time.h>
 #ifdef HAVE_SYSLOG
 #include <syslog.h>
 #endif
@@ -34,6 +40,11 @@
 #include "ms_job.h"
 #include "ms_real.c"
 
+#ifdef NO_BCOPY
+#define bcopy(s,d,n) memmove(d,s,n)
+#define bzero(d,n) memset(d,0,n)
+#endif
+
 /*
   Note that the timeout default below is overridden by mslavedc so that 
   manually started servers will persist throughout a typical session. 
@@ -45,6 +56,15 @@ char *me;			/* name of program */
 int timeout = DEFAULT_SLAVE_TIMEOUT;	/* timeout */
 int niceval = DEFAULT_NICE;	/* nice value */
 int use_sockets = 1;
+int force_scalar = 0;		/* don't use the vector kernels */
+int more_bulbs = 0;		/* test for period-3 and 4 bulbs too */
+int periodicity = 1;		/* approximate periodicity checking */
+int ladder = 1;			/* cheaper arithmetic where accurate enough */
+#ifdef CYCLE_DETECT
+int cycle_detect = 1;		/* detect limit cycles inside the set */
+#else
+int cycle_detect = 0;
+#endif
 
 /* Log an error message and exit */
 error(s)
@@ -88,34 +108,64 @@ char **p;
 	return r;
 }
 
-unsigned int mandelbrot(parms, maxiter, flags)
-real *parms;
+/*
+  Iterate a single point and return the iteration count.  "c" is the
+  parameter and "x" the initial value of z.  The "cycle_detect" and
+  "show_interior" arguments are constants at every call site (see the
+  row loops below), so the compiler generates a separate version of
+  the loop for each combination, with the tests folded away.
+
+  Without cycle detection, and if "real" is a double, the iterations
+  are done in blocks of ESCAPE_BATCH with no branch on the escape
+  test: the tests of a block are just or'ed together.  The block in
+  which the point escapes is then done over from its start one
+  iteration at a time, so the count is exactly the same.  With fixed
+  point, an orbit that has escaped would overflow before the end of
+  the block, so there it isn't done.
+
+  mandelbrot_z() also leaves the final z in *z_re and *z_im.
+*/
+
+#define ESCAPE_BATCH 8
+
+static inline unsigned int mandelbrot_z(c_re, c_im, z_re, z_im, maxiter,
+					cycle_detect, show_interior)
+register real c_re, c_im;
+real *z_re, *z_im;
 unsigned int maxiter;
-int flags;
+int cycle_detect;
+int show_interior;
 {
-	register real x_re, x_im;
-	register real c_re, c_im;
+	register real x_re = *z_re, x_im = *z_im;
 	register real xresq, ximsq;
-	complex c0;
-	complex z0;
 	real old_re = zero_real(), old_im = zero_real();
-	int show_interior;
 	unsigned int count;
 
-	show_interior = ! !(flags & MS_OPT_INTERIOR);
-
-	c0.re = parms[0];
-	c0.im = parms[1];
-	z0.re = parms[2];
-	z0.im = parms[3];
-
-	c_re = c0.re;
-	c_im = c0.im;
-	x_re = z0.re;
-	x_im = z0.im;
+	count = 0;
+#ifdef REAL_DOUBLE
+	if (!cycle_detect) {
+		while (count + ESCAPE_BATCH <= maxiter - 1) {
+			real save_re = x_re, save_im = x_im;
+			int escaped = 0, i;
+			for (i = 0; i < ESCAPE_BATCH; i++) {
+				xresq = mul_real(x_re, x_re);
+				ximsq = mul_real(x_im, x_im);
+				escaped |= gteq_real(add_real(xresq, ximsq),
+						     four_real());
+				x_im = add_real(twice_mul_real(x_re, x_im), c_im);
+				x_re = add_real(sub_real(xresq, ximsq), c_re);
+			}
+			if (escaped) {
+				x_re = save_re;
+				x_im = save_im;
+				break;
+			}
+			count += ESCAPE_BATCH;
+		}
+	}
+#endif
 
 	/* The following loop is where the Real Work gets done. */
-	count = 0;
 	while (count < maxiter - 1) {
 		/*
 		   The following if statement implements limit cycle detection
@@ -123,26 +173,26 @@ int flags;
 		   Unfortunately, it also slows down the calculation of other areas,
 		   to the degree that it probably pays off only when doing shallow
 		   zooms with large black areas on machines with slow multiply
-		   instructions.  Therefore it is now disabled by default.
+		   instructions.  Therefore it is disabled by default; the -c
+		   option turns it on.
 		 */
-
-#ifdef CYCLE_DETECT
-		if ((count & (count - 1)) == 0) {	/* "count" is zero or a power of two; save the current position */
-			old_re = x_re;
-			old_im = x_im;
-		} else {
-			/*
-			   Check if we have returned to a previously saved position; 
-			   if so, the iteration has converged to a limit cycle => we 
-			   are inside the Mandlebrot set and need iterate no further.
-			 */
-			if (x_re == old_re && x_im == old_im) {
-				if (!show_interior)
-					count = maxiter - 1;
-				break;
+		if (cycle_detect) {
+			if ((count & (count - 1)) == 0) {	/* "count" is zero or a power of two; save the current position */
+				old_re = x_re;
+				old_im = x_im;
+			} else {
+				/*
+				   Check if we have returned to a previously saved position; 
+				   if so, the iteration has converged to a limit cycle => we 
+				   are inside the Mandlebrot set and need iterate no further.
+				 */
+				if (x_re == old_re && x_im == old_im) {
+					if (!show_interior)
+						count = maxiter - 1;
+					break;
+				}
 			}
 		}
-#endif
 		/* 
 		   This is the familiar "z := z^2 + c; abort if |z| > 2"
 		   Mandelbrot iteration, with the arithmetic operators hidden
@@ -158,49 +208,839 @@ int flags;
 		x_re = add_real(sub_real(xresq, ximsq), c_re);
 		count++;
 	}
+	*z_re = x_re;
+	*z_im = x_im;
 	return count;
 }
 
-/* 
-  An alternative fractal.  This code is turned of for now because the
-  protocol doesn't yet support multiple fractal types.  
+static inline unsigned int mandelbrot(c_re, c_im, x_re, x_im, maxiter,
+				      cycle_detect, show_interior)
+real c_re, c_im;
+real x_re, x_im;
+unsigned int maxiter;
+int cycle_detect;
+int show_interior;
+{
+	return (mandelbrot_z(c_re, c_im, &x_re, &x_im, maxiter,
+			     cycle_detect, show_interior));
+}
+
+/*
+  Iterate a point like mandelbrot(), but check whether the orbit has
+  come back to within "eps" of a saved position, in which case it is
+  taken to be a limit cycle and the point to be inside the set.  The
+  position is saved whenever "count" is a power of two, so cycles of
+  any period are found within a few times their length after the
+  orbit has settled (Brent's method).  Unlike the exact test used by
+  cycle detection, this one also works with floating point, where an
+  orbit converging to a cycle may never repeat exactly.
 */
 
-#ifdef HENON
-unsigned int henon(parms, maxiter, flags)
-real *parms;
+static inline unsigned int mandelbrot_periodic(c_re, c_im, x_re, x_im,
+					       maxiter, eps)
+register real c_re, c_im;
+register real x_re, x_im;
 unsigned int maxiter;
-int flags;
+real eps;
 {
-	register real c0, c1;	/* coefficients */
-	register real x0, x1, x2;	/* states */
-
+	register real xresq, ximsq;
+	real old_re = x_re, old_im = x_im;
 	unsigned int count;
 
-	c0 = parms[0];
-	c1 = parms[1];
-	x1 = parms[2];
-	x2 = parms[3];
-
 	count = 0;
 	while (count < maxiter - 1) {
-		x0 = add_real(one_real(),
-			      add_real(mul_real(c0, x2),
-				       mul_real(c1, mul_real(x1, x1))));
-		x2 = x1;
-		x1 = x0;
-
-		if (x0 > int_to_real(10) || x0 < int_to_real(-10))
+		xresq = mul_real(x_re, x_re);
+		ximsq = mul_real(x_im, x_im);
+		if (gteq_real(add_real(xresq, ximsq), four_real()))
 			break;
-
+		x_im = add_real(twice_mul_real(x_re, x_im), c_im);
+		x_re = add_real(sub_real(xresq, ximsq), c_re);
 		count++;
+		if ((count & (count - 1)) == 0) {
+			old_re = x_re;
+			old_im = x_im;
+		} else if (gteq_real(eps, sub_real(x_re, old_re)) &&
+			   gteq_real(eps, sub_real(old_re, x_re)) &&
+			   gteq_real(eps, sub_real(x_im, old_im)) &&
+			   gteq_real(eps, sub_real(old_im, x_im))) {
+			count = maxiter - 1;
+			break;
+		}
 	}
 	return count;
 }
-#endif				/* HENON */
+
+#include "ms_simd.c"
+
+/*
+  Analytic interior tests.  Points inside the main cardioid or the
+  period-2 bulb are in the Mandelbrot set, and iterating them would
+  just use up the whole iteration limit, so we test for them first.
+  With the -b option we also test for a few discs that lie inside the
+  largest period-3 and period-4 bulbs; the discs were measured
+  numerically and made a little smaller than the bulbs to be safe.
+*/
+
+/* the rectangle holding all the shapes tested (symmetric about y = 0) */
+#define BULBS_MIN_RE(more) double_to_real((more) ? -1.37 : -1.25)
+#define BULBS_MAX_RE(more) double_to_real(0.38)
+#define BULBS_MAX_IM(more) double_to_real((more) ? 0.84 : 0.65)
+
+/* is c inside the disc with center (re, im) and squared radius r2? */
+#define IN_DISC(c_re, c_im, re, im, r2) \
+	(!gteq_real(add_real(mul_real(sub_real(c_re, double_to_real(re)), \
+				      sub_real(c_re, double_to_real(re))), \
+			     mul_real(sub_real(c_im, double_to_real(im)), \
+				      sub_real(c_im, double_to_real(im)))), \
+		    double_to_real(r2)))
+
+static inline int in_bulbs(c_re, c_im)
+register real c_re, c_im;
+{
+	real xq, y2, q;
+	/* the period-2 bulb: |c + 1| < 1/4 */
+	if (IN_DISC(c_re, c_im, -1.0, 0.0, 0.0625))
+		return 1;
+	/* the main cardioid: q (q + (x - 1/4)) < y^2 / 4 */
+	xq = sub_real(c_re, double_to_real(0.25));
+	y2 = mul_real(c_im, c_im);
+	q = add_real(mul_real(xq, xq), y2);
+	if (!gteq_real(mul_real(q, add_real(q, xq)),
+		       mul_real(y2, double_to_real(0.25))))
+		return 1;
+	if (more_bulbs) {
+		if (!gteq_real(c_im, zero_real()))
+			c_im = sub_real(zero_real(), c_im);
+		if (IN_DISC(c_re, c_im, -0.1226, 0.7449, 0.089 * 0.089) ||
+		    IN_DISC(c_re, c_im, 0.2823, 0.5301, 0.041 * 0.041) ||
+		    IN_DISC(c_re, c_im, -1.3107, 0.0, 0.055 * 0.055))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+  Does the rectangle with corners (x0, y0) and (x1, y1) meet any of
+  the shapes tested by in_bulbs()?  Chunks that don't (which is all
+  of them once we have zoomed in a bit) skip the tests altogether.
+*/
+
+static int chunk_meets_bulbs(x0, y0, x1, y1)
+real x0, y0, x1, y1;
+{
+	real t;
+	if (gteq_real(x0, x1)) {
+		t = x0;
+		x0 = x1;
+		x1 = t;
+	}
+	if (gteq_real(y0, y1)) {
+		t = y0;
+		y0 = y1;
+		y1 = t;
+	}
+	return (gteq_real(x1, BULBS_MIN_RE(more_bulbs)) &&
+		gteq_real(BULBS_MAX_RE(more_bulbs), x0) &&
+		gteq_real(y1, sub_real(zero_real(), BULBS_MAX_IM(more_bulbs)))
+		&& gteq_real(BULBS_MAX_IM(more_bulbs), y0));
+}
+
+/*
+  Row loops.  Each of these calculates one scanline of a chunk: "x"
+  and "y" are the parameters that vary with the pixel coordinates
+  (c for the Mandelbrot set, z0 for Julia sets), "k0" and "k1" the
+  two that don't, and "dx" is the step between pixels.  The counts
+  are stored at "out" in the reply format.
+
+  There is one row loop for every combination of fractal type,
+  interior display, cycle detection, interior tests and count size,
+  all generated from the same macros.  calculate() picks the right one once per
+  message, so the only data-dependent branch left in the inner loop
+  is the escape test.
+*/
+
+/* ways of storing a count in the reply */
+#define STORE_8(out, i, count) (((uint8 *) (out))[i] = (count))
+#define STORE_16(out, i, count) (((uint16 *) (out))[i] = htons(count))
+
+/* the tolerance of mandelbrot_periodic(), set by calculate() */
+static real period_eps;
+
+/* ways of iterating a point */
+#define ITER_M(x, y, k0, k1, maxiter, cyc, intr) \
+	mandelbrot(x, y, k0, k1, maxiter, cyc, intr)
+#define ITER_J(x, y, k0, k1, maxiter, cyc, intr) \
+	mandelbrot(k0, k1, x, y, maxiter, cyc, intr)
+#define ITER_MP(x, y, k0, k1, maxiter, cyc, intr) \
+	mandelbrot_periodic(x, y, k0, k1, maxiter, period_eps)
+#define ITER_JP(x, y, k0, k1, maxiter, cyc, intr) \
+	mandelbrot_periodic(k0, k1, x, y, maxiter, period_eps)
+
+/* a pixel-at-a-time row loop */
+#define SCALAR_ROW(name, ITER, CYCLE, INTERIOR, BULBS, STORE) \
+static unsigned long name(n, x, y, dx, k0, k1, out, maxiter) \
+int n; \
+real x, y, dx, k0, k1; \
+char *out; \
+unsigned int maxiter; \
+{ \
+	unsigned long mi_count = 0; \
+	int i; \
+	for (i = 0; i < n; i++) { \
+		unsigned int count = (BULBS && in_bulbs(x, y)) ? maxiter - 1 : \
+		    ITER(x, y, k0, k1, maxiter, CYCLE, INTERIOR); \
+		STORE(out, i, count); \
+		mi_count += count; \
+		x = add_real(x, dx); \
+	} \
+	return mi_count; \
+}
+
+#include "ms_pool.c"
+#include "ms_pack.c"
+
+/* no reply can hold more pixels than this, so neither can a scanline */
+#define MAX_ROW MAX_DATAGRAM
+
+/* per-scanline buffers for the vector kernels, one set per thread */
+static THREAD_LOCAL real row_buf[4][MAX_ROW];
+#ifdef REAL_DOUBLE
+static THREAD_LOCAL float row_buf_float[4][MAX_ROW];
+#endif
+static THREAD_LOCAL unsigned int row_counts[MAX_ROW];
+static THREAD_LOCAL int row_index[MAX_ROW];
+
+/*
+  A row loop using the kernel chosen by simd_init(), "KERNEL", with
+  its row buffers "BUF" (points_kernel and row_buf, or the single
+  precision versions); "VARY" is the index of the first row buffer
+  that varies with x (0 for c, 2 for z0).  With "BULBS" set, the
+  points that pass the interior tests are stored at once and only
+  the rest are passed on to the kernel; "row_index" remembers where
+  their counts go.
+*/
+#define VECTOR_ROW(name, VARY, BULBS, STORE, BUF, KERNEL) \
+static unsigned long name(n, x, y, dx, k0, k1, out, maxiter) \
+int n; \
+real x, y, dx, k0, k1; \
+char *out; \
+unsigned int maxiter; \
+{ \
+	unsigned long mi_count = 0; \
+	int i, m = 0; \
+	for (i = 0; i < n; i++) { \
+		if (BULBS && in_bulbs(x, y)) { \
+			STORE(out, i, maxiter - 1); \
+			mi_count += maxiter - 1; \
+		} else { \
+			BUF[VARY][m] = x; \
+			BUF[VARY + 1][m] = y; \
+			BUF[2 - VARY][m] = k0; \
+			BUF[3 - VARY][m] = k1; \
+			row_index[m++] = i; \
+		} \
+		x = add_real(x, dx); \
+	} \
+	mi_count += (*KERNEL) (m, BUF[0], BUF[1], BUF[2], BUF[3], \
+			       row_counts, maxiter); \
+	for (i = 0; i < m; i++) \
+		STORE(out, BULBS ? row_index[i] : i, row_counts[i]); \
+	return mi_count; \
+}
+
+VECTOR_ROW(m_8, 0, 0, STORE_8, row_buf, points_kernel)
+VECTOR_ROW(m_16, 0, 0, STORE_16, row_buf, points_kernel)
+SCALAR_ROW(m_cyc_8, ITER_M, 1, 0, 0, STORE_8)
+SCALAR_ROW(m_cyc_16, ITER_M, 1, 0, 0, STORE_16)
+SCALAR_ROW(m_cyc_int_8, ITER_M, 1, 1, 0, STORE_8)
+SCALAR_ROW(m_cyc_int_16, ITER_M, 1, 1, 0, STORE_16)
+VECTOR_ROW(m_b_8, 0, 1, STORE_8, row_buf, points_kernel)
+VECTOR_ROW(m_b_16, 0, 1, STORE_16, row_buf, points_kernel)
+SCALAR_ROW(m_cyc_b_8, ITER_M, 1, 0, 1, STORE_8)
+SCALAR_ROW(m_cyc_b_16, ITER_M, 1, 0, 1, STORE_16)
+VECTOR_ROW(j_8, 2, 0, STORE_8, row_buf, points_kernel)
+VECTOR_ROW(j_16, 2, 0, STORE_16, row_buf, points_kernel)
+SCALAR_ROW(j_cyc_8, ITER_J, 1, 0, 0, STORE_8)
+SCALAR_ROW(j_cyc_16, ITER_J, 1, 0, 0, STORE_16)
+SCALAR_ROW(j_cyc_int_8, ITER_J, 1, 1, 0, STORE_8)
+SCALAR_ROW(j_cyc_int_16, ITER_J, 1, 1, 0, STORE_16)
+SCALAR_ROW(m_per_8, ITER_MP, 0, 0, 0, STORE_8)
+SCALAR_ROW(m_per_16, ITER_MP, 0, 0, 0, STORE_16)
+SCALAR_ROW(m_per_b_8, ITER_MP, 0, 0, 1, STORE_8)
+SCALAR_ROW(m_per_b_16, ITER_MP, 0, 0, 1, STORE_16)
+SCALAR_ROW(j_per_8, ITER_JP, 0, 0, 0, STORE_8)
+SCALAR_ROW(j_per_16, ITER_JP, 0, 0, 0, STORE_16)
+VECTOR_ROW(h_8, 0, 0, STORE_8, row_buf, henon_kernel)
+VECTOR_ROW(h_16, 0, 0, STORE_16, row_buf, henon_kernel)
+VECTOR_ROW(m3_8, 0, 0, STORE_8, row_buf, multibrot3_kernel)
+VECTOR_ROW(m3_16, 0, 0, STORE_16, row_buf, multibrot3_kernel)
+VECTOR_ROW(m4_8, 0, 0, STORE_8, row_buf, multibrot4_kernel)
+VECTOR_ROW(m4_16, 0, 0, STORE_16, row_buf, multibrot4_kernel)
+VECTOR_ROW(m5_8, 0, 0, STORE_8, row_buf, multibrot5_kernel)
+VECTOR_ROW(m5_16, 0, 0, STORE_16, row_buf, multibrot5_kernel)
+VECTOR_ROW(bs_8, 0, 0, STORE_8, row_buf, ship_kernel)
+VECTOR_ROW(bs_16, 0, 0, STORE_16, row_buf, ship_kernel)
+
+/*
+  The kernel registry: for each fractal type the server can draw,
+  which parameters vary with the pixel and the row loops to use.
+  "row_loops" is indexed by interior flag, cycle detection and wide
+  counts, and "periodic_loops", the loops with approximate
+  periodicity checking, by interior tests and wide counts.  Only
+  Mandelbrot and Julia sets have cycle detection, interior display
+  and periodicity checking; the others have a single loop for each
+  count size, built on their kernel in ms_simd.c.  Like the interior
+  tests, the periodic loops are not used when displaying interior
+  structure with cycle detection.  A type without an entry here is
+  neither drawn nor advertised.
+*/
+#define ONE_LOOP(l8, l16) \
+	{{{l8, l16}, {l8, l16}}, {{l8, l16}, {l8, l16}}}, \
+	{{l8, l16}, {l8, l16}}
+
+static struct fractal {
+	int vary;		/* the first parameter varying with x */
+	unsigned long (*row_loops[2][2][2]) ();
+	unsigned long (*periodic_loops[2][2]) ();
+} fractals[N_FRACTALS] = {
+	{			/* FRACTAL_MANDELBROT */
+	 0,
+	 {{{m_8, m_16}, {m_cyc_8, m_cyc_16}},
+	  {{m_8, m_16}, {m_cyc_int_8, m_cyc_int_16}}},
+	 {{m_per_8, m_per_16}, {m_per_b_8, m_per_b_16}}
+	 },
+	{			/* FRACTAL_JULIA */
+	 2,
+	 {{{j_8, j_16}, {j_cyc_8, j_cyc_16}},
+	  {{j_8, j_16}, {j_cyc_int_8, j_cyc_int_16}}},
+	 {{j_per_8, j_per_16}, {j_per_8, j_per_16}}
+	 },
+	{0, ONE_LOOP(h_8, h_16)},	/* FRACTAL_HENON */
+	{0, ONE_LOOP(m3_8, m3_16)},	/* FRACTAL_MULTIBROT3 */
+	{0, ONE_LOOP(m4_8, m4_16)},	/* FRACTAL_MULTIBROT4 */
+	{0, ONE_LOOP(m5_8, m5_16)},	/* FRACTAL_MULTIBROT5 */
+	{0, ONE_LOOP(bs_8, bs_16)}	/* FRACTAL_BURNING_SHIP */
+};
+
+/* the types in the registry, as advertised in an IAmMessage */
+
+static unsigned int fractal_mask()
+{
+	unsigned int mask = 0;
+	int i;
+	for (i = 0; i < N_FRACTALS; i++)
+		if (fractals[i].row_loops[0][0][0])
+			mask |= 1 << i;
+	return (mask);
+}
+
+/*
+  The Mandelbrot row loops with interior tests, indexed by cycle
+  detection and wide counts.  They are not used when displaying
+  interior structure with cycle detection, since the tests would
+  hide the structure.
+*/
+static unsigned long (*bulb_loops[2][2]) () = {
+	{m_b_8, m_b_16},
+	{m_cyc_b_8, m_cyc_b_16}
+};
+
+/*
+  The precision ladder.  Each chunk is calculated with the cheapest
+  arithmetic that is accurate enough for it: a floating-point type
+  with "bits" significant bits will do if the pixel spacing is at
+  least PREC_GUARD_BITS bits above the resolution of the type at the
+  largest number in the calculation, which is the largest coordinate
+  in the chunk, or 2 for the orbit itself.  Ordinary jobs use floats
+  when they can (if "real" is a double), and MS_OPT_MP jobs "real" or
+  double-doubles (see ms_mp.c).  The -f option turns this off.
+*/
+
+#define PREC_GUARD_BITS 12
+#define FLOAT_BITS	24
+#define DOUBLE_BITS	53
+#define DOUBLE_DOUBLE_BITS 104	/* a little less than 2 * 53, to be safe */
+
+static int precision_enough(bits, spacing, magnitude)
+int bits;
+double spacing, magnitude;
+{
+	int i;
+	if (magnitude < 2.0)
+		magnitude = 2.0;
+	if (spacing < 0)
+		spacing = -spacing;
+	for (i = PREC_GUARD_BITS; i < bits; i++)
+		magnitude /= 2.0;
+	return (spacing >= magnitude);
+}
+
+/* the largest magnitude of the numbers "x", and the largest so far "m" */
+#define LARGER_ABS(m, x) ((x) > (m) ? (x) : -(x) > (m) ? -(x) : (m))
+
+#ifdef REAL_DOUBLE
+VECTOR_ROW(m_f_8, 0, 0, STORE_8, row_buf_float, points_kernel_float)
+VECTOR_ROW(m_f_16, 0, 0, STORE_16, row_buf_float, points_kernel_float)
+VECTOR_ROW(m_f_b_8, 0, 1, STORE_8, row_buf_float, points_kernel_float)
+VECTOR_ROW(m_f_b_16, 0, 1, STORE_16, row_buf_float, points_kernel_float)
+VECTOR_ROW(j_f_8, 2, 0, STORE_8, row_buf_float, points_kernel_float)
+VECTOR_ROW(j_f_16, 2, 0, STORE_16, row_buf_float, points_kernel_float)
+
+/*
+  The single-precision row loops, indexed by fractal type (Mandelbrot
+  or Julia), interior tests and wide counts.  There are none with
+  cycle detection, which needs exact arithmetic to be worthwhile.
+*/
+static unsigned long (*float_loops[2][2][2]) () = {
+	{{m_f_8, m_f_16}, {m_f_b_8, m_f_b_16}},
+	{{j_f_8, j_f_16}, {j_f_8, j_f_16}}
+};
+#endif
+
+/*
+  The level of "real" itself, and whether it is precise enough for a
+  pixel spacing with "guard" extra guard bits.  Fixed point is as
+  precise everywhere as a floating-point type of one bit more is at
+  2, the smallest magnitude precision_enough() considers.
+*/
+#ifdef REAL_DOUBLE
+#define REAL_PRECISION PREC_DOUBLE
+#define real_precision_enough(guard, spacing, magnitude) \
+	precision_enough(DOUBLE_BITS - (guard), spacing, magnitude)
+#else
+#ifdef REAL_FIXED64
+#define REAL_PRECISION PREC_FIXED64
+#else
+#define REAL_PRECISION PREC_FIXED
+#endif
+#define real_precision_enough(guard, spacing, magnitude) \
+	precision_enough(REAL_RIGHTBITS + 1 - (guard), spacing, 0.0)
+#endif
+
+/* did any pixel of a row of "n" counts at "p" reach the limit? */
+
+static int row_hit_limit(p, n, bytes_per_count, maxiter)
+char *p;
+int n;
+unsigned int bytes_per_count;
+unsigned int maxiter;
+{
+	int i;
+	if (bytes_per_count == 1) {
+		for (i = 0; i < n; i++)
+			if (((uint8 *) p)[i] == maxiter - 1)
+				return 1;
+	} else {
+		for (i = 0; i < n; i++)
+			if (ntohs(((uint16 *) p)[i]) == maxiter - 1)
+				return 1;
+	}
+	return 0;
+}
+
+#include "ms_deep.c"
+#include "ms_mp.c"
+
+/*
+  The "guessing" algorithm of Mariani and Silver, used when the job
+  has the MS_OPT_GUESS flag set.  The border of a rectangle is
+  calculated first; if every pixel on it has the same count, the
+  inside is filled with that count without iterating it, otherwise
+  the rectangle is split in two across its longer side and each half
+  is handled the same way.  This is a guess, not a proof: a thin
+  filament passing through a rectangle without touching its border
+  will be missed.
+
+  The pixel coordinates are calculated once per message into
+  "guess_xs" and "guess_ys", by the same additions the row loops
+  do, so that every pixel that does get calculated has exactly the
+  same count it would have without guessing.  The spans of pixels
+  are calculated by the ordinary row loops, writing straight into
+  the reply.
+*/
+
+static real guess_xs[MAX_ROW], guess_ys[MAX_ROW];
+static real guess_dx, guess_k0, guess_k1;
+static char *guess_out;		/* the counts in the reply */
+static int guess_xsize;		/* the width of the chunk */
+static unsigned int guess_bytes;	/* bytes per count */
+static unsigned int guess_maxiter;
+static unsigned long (*guess_loop) ();
+static unsigned long (*guess_periodic_loop) ();
+static int guess_limit_seen;	/* true if the last span reached the limit */
+static unsigned long (*guess_row) ();	/* deep_row() etc., or NULL */
+static unsigned long guess_mi_count;
+
+/* the address of the count of a pixel in the reply */
+#define GUESS_P(x, y) \
+	(guess_out + ((y) * guess_xsize + (x)) * guess_bytes)
+
+/* the count of a pixel already calculated */
+#define GUESS_GET(x, y) (guess_bytes == 1 ? \
+	(unsigned int) *(uint8 *) GUESS_P(x, y) : \
+	(unsigned int) ntohs(*(uint16 *) GUESS_P(x, y)))
+
+/*
+  Calculate "n" pixels starting at (x, y) and going right, storing
+  the counts at "p".
+*/
+
+static void guess_calc(x, y, n, p)
+int x, y, n;
+char *p;
+{
+	if (guess_row) {
+		guess_mi_count += (*guess_row) (x, y, n, p);
+		return;
+	}
+	guess_mi_count +=
+	    (*(guess_limit_seen ? guess_periodic_loop : guess_loop))
+	    (n, guess_xs[x], guess_ys[y], guess_dx, guess_k0, guess_k1, p,
+	     guess_maxiter);
+	if (guess_periodic_loop != guess_loop)
+		guess_limit_seen = row_hit_limit(p, n, guess_bytes,
+						 guess_maxiter);
+}
+
+/* calculate "n" pixels starting at (x, y) and going right */
+
+static void guess_span(x, y, n)
+int x, y, n;
+{
+	guess_calc(x, y, n, GUESS_P(x, y));
+}
+
+/* calculate "n" pixels starting at (x, y) and going down */
+
+static void guess_column(x, y, n)
+int x, y, n;
+{
+	while (n-- > 0)
+		guess_span(x, y++, 1);
+}
+
+/*
+  Handle the rectangle at (x0, y0) of size w by h, whose border has
+  already been calculated.
+*/
+
+static void guess_rect(x0, y0, w, h)
+int x0, y0, w, h;
+{
+	int x1 = x0 + w - 1, y1 = y0 + h - 1;
+	unsigned int count;
+	int x, y, m;
+
+	if (w <= 2 || h <= 2)
+		return;		/* all border, nothing inside */
+
+	count = GUESS_GET(x0, y0);
+	for (x = x0; x <= x1; x++)
+		if (GUESS_GET(x, y0) != count || GUESS_GET(x, y1) != count)
+			goto split;
+	for (y = y0 + 1; y < y1; y++)
+		if (GUESS_GET(x0, y) != count || GUESS_GET(x1, y) != count)
+			goto split;
+
+	/* the border is uniform; fill in the inside */
+	for (y = y0 + 1; y < y1; y++)
+		for (x = x0 + 1; x < x1; x++) {
+			if (guess_bytes == 1)
+				*(uint8 *) GUESS_P(x, y) = count;
+			else
+				*(uint16 *) GUESS_P(x, y) = htons(count);
+		}
+	return;
+
+ split:
+	if (w >= h) {
+		m = x0 + w / 2;
+		guess_column(m, y0 + 1, h - 2);
+		guess_rect(x0, y0, m - x0 + 1, h);
+		guess_rect(m, y0, x1 - m + 1, h);
+	} else {
+		m = y0 + h / 2;
+		guess_span(x0 + 1, m, w - 2);
+		guess_rect(x0, y0, w, m - y0 + 1);
+		guess_rect(x0, m, w, y1 - m + 1);
+	}
+}
+
+/*
+  Set up the variables above for a chunk of w by h pixels.  The row
+  loops and their arguments are those calculate() would use without
+  guessing.
+*/
+
+static void guess_setup(w, h, x, y, dx, dy, k0, k1, out,
+			bytes_per_count, maxiter, row_loop, periodic_loop)
+int w, h;
+real x, y, dx, dy, k0, k1;
+char *out;
+unsigned int bytes_per_count;
+unsigned int maxiter;
+unsigned long (*row_loop) ();
+unsigned long (*periodic_loop) ();
+{
+	int i;
+	for (i = 0; i < w; i++) {
+		guess_xs[i] = x;
+		x = add_real(x, dx);
+	}
+	for (i = 0; i < h; i++) {
+		guess_ys[i] = y;
+		y = add_real(y, dy);
+	}
+	guess_dx = dx;
+	guess_k0 = k0;
+	guess_k1 = k1;
+	guess_out = out;
+	guess_xsize = w;
+	guess_bytes = bytes_per_count;
+	guess_maxiter = maxiter;
+	guess_loop = row_loop;
+	guess_periodic_loop = periodic_loop;
+	guess_limit_seen = 0;
+	guess_row = 0;
+	guess_mi_count = 0;
+}
+
+/*
+  Calculate a whole chunk of w by h pixels by guessing.  Returns the
+  number of iterations done.
+*/
+
+static unsigned long guess_chunk(w, h)
+int w, h;
+{
+	/* the border of the whole chunk */
+	guess_span(0, 0, w);
+	if (h > 1)
+		guess_span(0, h - 1, w);
+	guess_column(0, 1, h - 2);
+	if (w > 1)
+		guess_column(w - 1, 1, h - 2);
+
+	guess_rect(0, 0, w, h);
+	return guess_mi_count;
+}
+
+/*
+  Calculate the grid lines of a chunk of w by h pixels for a job with
+  the MS_OPT_GRID flag set, packing the counts together.  Returns the
+  number of iterations done.
+*/
+
+static unsigned long grid_chunk(w, h, gx, gy)
+int w, h, gx, gy;
+{
+	char *p = guess_out;
+	int x, y;
+	for (y = 0; y < h; y++) {
+		if (MS_ON_GRID(h, gy, y)) {
+			guess_calc(0, y, w, p);
+			p += w * guess_bytes;
+		} else {
+			for (x = 0; x < w; x++)
+				if (MS_ON_GRID(w, gx, x)) {
+					guess_calc(x, y, 1, p);
+					p += guess_bytes;
+				}
+		}
+	}
+	return guess_mi_count;
+}
+
+/*
+  MS_OPT_STATE and MS_OPT_RESUME jobs (see ms_job.h).  These are
+  calculated with the kernel chosen by simd_init() in "real", without
+  cycle detection, periodicity checking or the precision ladder, so
+  that the state of a pixel is exactly where its orbit has got to,
+  and continuing it gives the same count as starting over with the
+  higher limit would.  The pixels are walked in the same order as in
+  the row loops, so that their coordinates come out the same too.
+  Returns the number of iterations done, and leaves "*sp" pointing
+  after the last state stored.
+*/
+
+static int row_slot[MAX_ROW];	/* where each pixel of a row went */
+
+static void put_state(sp, iterations, z_re, z_im)
+ms_pixel_state **sp;
+unsigned int iterations;
+real z_re, z_im;
+{
+	double d;
+	(*sp)->iterations = htonl(iterations);
+	d = real_to_double(z_re);
+	MS_DOUBLE_TO_NET(d, &(*sp)->z[0]);
+	d = real_to_double(z_im);
+	MS_DOUBLE_TO_NET(d, &(*sp)->z[2]);
+	(*sp)++;
+}
+
+/* run the kernel on slots m0 to m - 1, which have all done "start" */
+
+static unsigned long state_run(m0, m, start, out, bytes_per_count, maxiter)
+int m0, m;
+unsigned int start;
+char *out;
+unsigned int bytes_per_count;
+unsigned int maxiter;
+{
+	unsigned long mi_count;
+	int j;
+	if (m == m0)
+		return (0);
+	mi_count = (*points_kernel) (m - m0, row_buf[0] + m0,
+				     row_buf[1] + m0, row_buf[2] + m0,
+				     row_buf[3] + m0, row_counts + m0,
+				     maxiter - start);
+	for (j = m0; j < m; j++) {
+		row_counts[j] += start;
+		if (bytes_per_count == 1)
+			STORE_8(out, row_index[j], row_counts[j]);
+		else
+			STORE_16(out, row_index[j], row_counts[j]);
+	}
+	return (mi_count);
+}
+
+static unsigned long state_chunk(job, flags, type, x0, y, dx, dy, k0, k1,
+				 xsize, ysize, out, bytes_per_count, maxiter,
+				 sp)
+ms_job *job;
+int flags, type;
+real x0, y, dx, dy, k0, k1;
+int xsize, ysize;
+char *out;
+unsigned int bytes_per_count;
+unsigned int maxiter;
+ms_pixel_state **sp;
+{
+	ms_resume_pixel *rp = ((ms_resume_job *) (job + 1))->pixels;
+	int n_resume = ntohs(((ms_resume_job *) (job + 1))->n_pixels);
+	int vary = (type == FRACTAL_JULIA) ? 2 : 0;
+	int bulbs = (type == FRACTAL_MANDELBROT && k0 == zero_real() &&
+		     k1 == zero_real());
+	unsigned long mi_count = 0;
+	unsigned int start = 0, it;
+	int xc, yc, m0, m, j;
+	real x;
+	double d;
+
+	if (flags & MS_OPT_RESUME)
+		bzero(out, xsize * ysize * bytes_per_count);
+	for (yc = 0; yc < ysize; yc++, y = add_real(y, dy)) {
+		m0 = m = 0;
+		x = x0;
+		for (xc = 0; xc < xsize; xc++, x = add_real(x, dx)) {
+			row_slot[xc] = -2;	/* not calculated */
+			if (flags & MS_OPT_RESUME) {
+				if (n_resume == 0 ||
+				    ntohs(rp->index) != yc * xsize + xc)
+					continue;
+				it = ntohl(rp->state.iterations);
+				if (it != MS_STATE_INSIDE) {
+					if (it > maxiter - 1)
+						it = maxiter - 1;
+					MS_NET_TO_DOUBLE(&rp->state.z[0], d);
+					row_buf[2][m] = double_to_real(d);
+					MS_NET_TO_DOUBLE(&rp->state.z[2], d);
+					row_buf[3][m] = double_to_real(d);
+				}
+				rp++;
+				n_resume--;
+			} else {
+				it = (bulbs && in_bulbs(x, y)) ?
+				    MS_STATE_INSIDE : 0;
+				row_buf[2][m] = vary ? x : k0;
+				row_buf[3][m] = vary ? y : k1;
+			}
+			if (it == MS_STATE_INSIDE) {
+				row_slot[xc] = -1;
+				if (bytes_per_count == 1)
+					STORE_8(out, yc * xsize + xc,
+						maxiter - 1);
+				else
+					STORE_16(out, yc * xsize + xc,
+						 maxiter - 1);
+				continue;
+			}
+			/* the kernel takes one iteration limit per call */
+			if (it != start) {
+				mi_count += state_run(m0, m, start, out,
+						      bytes_per_count,
+						      maxiter);
+				m0 = m;
+				start = it;
+			}
+			row_buf[0][m] = vary ? k0 : x;
+			row_buf[1][m] = vary ? k1 : y;
+			row_index[m] = yc * xsize + xc;
+			row_slot[xc] = m++;
+		}
+		mi_count += state_run(m0, m, start, out, bytes_per_count,
+				      maxiter);
+		if (!(flags & MS_OPT_STATE))
+			continue;
+		for (xc = 0; xc < xsize; xc++) {
+			j = row_slot[xc];
+			if (j == -1)
+				put_state(sp, MS_STATE_INSIDE, zero_real(),
+					  zero_real());
+			else if (j >= 0 && row_counts[j] == maxiter - 1)
+				put_state(sp, maxiter - 1, row_buf[2][j],
+					  row_buf[3][j]);
+		}
+	}
+	return (mi_count);
+}
+
+/*
+  The chunk being calculated row by row, for chunk_row(), which is
+  called by pool_rows() on each of its rows.  "ys" holds the
+  coordinate of each row, summed in order as the rows were before
+  they could be done in any order, so that the results don't change.
+*/
+static struct {
+	real x, dx, k0, k1;
+	real ys[MAX_ROW];
+	char *out;
+	int xsize;
+	unsigned int bytes_per_count;
+	unsigned int maxiter;
+	unsigned long (*row_loop) ();
+	unsigned long (*periodic_loop) ();
+	unsigned long (*pixel_row) ();	/* deep_row() etc., or NULL */
+} chunk;
+
+static unsigned long chunk_row(y, limit_seen)
+int y;
+int *limit_seen;
+{
+	char *outp = chunk.out + y * chunk.xsize * chunk.bytes_per_count;
+	unsigned long mi_count;
+
+	if (chunk.pixel_row)
+		return (*chunk.pixel_row) (0, y, chunk.xsize, outp);
+	mi_count = (*(*limit_seen ? chunk.periodic_loop : chunk.row_loop))
+	    (chunk.xsize, chunk.x, chunk.ys[y], chunk.dx, chunk.k0, chunk.k1,
+	     outp, chunk.maxiter);
+	if (chunk.periodic_loop != chunk.row_loop)
+		*limit_seen = row_hit_limit(outp, chunk.xsize,
+					    chunk.bytes_per_count,
+					    chunk.maxiter);
+	return (mi_count);
+}
+
+static int poll_messages();
 
 #define MAX_PARMS 32
 
+/* the periodicity checking tolerance, in pixels */
+#define PERIOD_EPS (1.0 / 1024)
+
 /*
   Do the actual calculation and encode the results in an reply message;
   return the size of the message (in bytes) 
@@ -209,23 +1049,31 @@ int flags;
 unsigned int calculate(in, out)
 Message *in, *out;
 {
-	int julia;		/* true if calculating a Julia set */
+	int type;		/* fractal type */
 	int show_interior;	/* true if displaying interior structure */
 	complex delta;
 
-	int xc, yc, xmin, xmax, xsize, ymin, ymax, ysize;
+	int yc, xmin, xsize, ymin, ysize;
 	unsigned int maxiter;
 	unsigned long mi_count = 0;
 	unsigned int datasize;
+	unsigned int bytes_per_count;
 	int flags;
 	ms_job *job;
 	char *p;		/* untyped pointer to parameter block in message */
+	char *outp;		/* where the counts of the current row go */
 	int x_parm_no, y_parm_no;	/* indices of parameters to vary with x/y coord */
-	real *varx, *vary;	/* pointers to same */
-	real initial_varx;
+	int k_parm_no;		/* index of the first parameter that doesn't */
+	real x, y;		/* coordinates of the first pixel of a row */
 	real parm_buf[MAX_PARMS];
 	int n_parms;
 	int i;
+	unsigned long (*row_loop) ();
+	unsigned long (*periodic_loop) ();
+	int bulbs;		/* true if the interior tests are worthwhile */
+	int grid_x = 0, grid_y = 0;	/* grid line spacing for MS_OPT_GRID */
+	unsigned int n_counts;	/* number of counts in the reply */
+	int precision;		/* the arithmetic used, PREC_xxx */
 
 #define parms parm_buf
 
@@ -239,25 +1087,44 @@ Message *in, *out;
 	/* useful values */
 	xmin = ntohs(job->s.x);
 	xsize = ntohs(job->s.width);
-	xmax = xmin + xsize;
 	ymin = ntohs(job->s.y);
 	ysize = ntohs(job->s.height);
-	ymax = ymin + ysize;
 
 	maxiter = ntohli(job->j.iteration_limit);
 
+	flags = ntohs(job->j.flags);
+	n_counts = xsize * ysize;
+	if (flags & MS_OPT_GRID) {
+		grid_x = ntohs(job->grid_x);
+		grid_y = ntohs(job->grid_y);
+		if (grid_x == 0 || grid_y == 0 || n_counts == 0)
+			return (0);
+		n_counts = MS_GRID_PIXELS(xsize, ysize, grid_x, grid_y);
+	}
+
+	bytes_per_count = (maxiter > 256) ? 2 : 1;
 	datasize = (maxiter > 256) ?
-	    ((char *)(&(out->reply.data.shorts[xsize * ysize]))
+	    ((char *)(&(out->reply.data.shorts[n_counts]))
 	     - (char *)(&(out->reply))) :
-	    ((char *)(&(out->reply.data.chars[xsize * ysize]))
+	    ((char *)(&(out->reply.data.chars[n_counts]))
 	     - (char *)(&(out->reply)));
 
 	/*
 	   Perform a simple sanity check to avoid getting into semi-infinite 
-	   loops because of malicious or erroneous messages.
+	   loops because of malicious or erroneous messages.  A packed
+	   reply is calculated into pack_buf first (see ms_pack.c).
 	 */
-	if (datasize > MAX_DATAGRAM)
-		error("data too large");
+	if (flags & MS_OPT_PACK) {
+		if ((flags & (MS_OPT_STATE | MS_OPT_RESUME)) ||
+		    n_counts > MS_PACK_MAX_PIXELS ||
+		    xsize > MS_PACK_MAX_ROW || ysize > MS_PACK_MAX_ROW)
+			return (0);
+		outp = (char *)pack_buf;
+	} else {
+		if (datasize > MAX_DATAGRAM)
+			error("data too large");
+		outp = (char *)&out->reply.data;
+	}
 
 	/* 
 	   Make sure the iteration counts can be represented in the result
@@ -268,20 +1135,61 @@ Message *in, *out;
 	if (maxiter >= 65536)
 		error("iteration count too large");
 
-	flags = ntohs(job->j.flags);
-	julia = ntohs(job->j.julia);
-
-	if (julia) {
-		n_parms = 4;
-		x_parm_no = 2;	/* z0.re */
-		y_parm_no = 3;	/* z0.im */
-	} else {		/* Mandelbrot */
+	show_interior = ! !(flags & MS_OPT_INTERIOR);
+	type = ntohs(job->j.julia);
+	if (type >= N_FRACTALS || !fractals[type].row_loops[0][0][0])
+		return (0);	/* not something we know how to draw */
 
-		n_parms = 4;
-		x_parm_no = 0;	/* c0.re */
-		y_parm_no = 1;	/* c0.im */
+	if ((flags & (MS_OPT_STATE | MS_OPT_RESUME)) &&
+	    ((flags & (MS_OPT_GUESS | MS_OPT_GRID | MS_OPT_DEEP | MS_OPT_MP))
+	     || type > FRACTAL_JULIA || n_counts > MS_STATE_MAX_PIXELS))
+		return (0);
+	if (flags & (MS_OPT_DEEP | MS_OPT_MP)) {
+		unsigned long (*pixel_row) ();
+		if (flags & MS_OPT_DEEP) {
+			if (type != FRACTAL_MANDELBROT ||
+			    !deep_setup((ms_deep_job *) (job + 1), xmin, ymin,
+					xsize, ysize, bytes_per_count, maxiter))
+				return (0);
+			pixel_row = deep_row;
+			precision = PREC_PERTURB;
+		} else {
+			if (!mp_setup((ms_mp_job *) (job + 1), type, xmin, ymin,
+				      xsize, ysize, bytes_per_count, maxiter,
+				      show_interior))
+				return (0);
+			pixel_row = mp_row;
+			precision = mp_precision;
+		}
+		if (flags & (MS_OPT_GUESS | MS_OPT_GRID)) {
+			guess_setup(xsize, ysize, zero_real(), zero_real(),
+				    zero_real(), zero_real(), zero_real(),
+				    zero_real(), outp, bytes_per_count, maxiter,
+				    (unsigned long (*)())0,
+				    (unsigned long (*)())0);
+			guess_row = pixel_row;
+			mi_count = (flags & MS_OPT_GRID) ?
+			    grid_chunk(xsize, ysize, grid_x, grid_y) :
+			    guess_chunk(xsize, ysize);
+		} else {
+			chunk.pixel_row = pixel_row;
+			chunk.out = outp;
+			chunk.xsize = xsize;
+			chunk.bytes_per_count = bytes_per_count;
+			mi_count = pool_rows(ysize, chunk_row, poll_messages);
+		}
+		out->reply.mi_count = htonl(mi_count);
+		out->reply.precision = htons(precision);
+		return ((flags & MS_OPT_PACK) ?
+			pack_reply(out, n_counts, bytes_per_count) : datasize);
 	}
 
+	/* c0 varies with the pixel and z0 is fixed, or the other way round */
+	n_parms = 4;
+	x_parm_no = fractals[type].vary;
+	y_parm_no = x_parm_no + 1;
+	k_parm_no = 2 - x_parm_no;
+
 	/* point to beginning of parameters */
 	p = (char *)&job->j.corner.re;
 
@@ -289,102 +1197,363 @@ Message *in, *out;
 	for (i = 0; i < n_parms; i++)
 		parm_buf[i] = decode_parm(&p);
 
-	/* set up pointers to the parameters that correspond to x and y */
-	varx = &parm_buf[x_parm_no];
-	vary = &parm_buf[y_parm_no];
-
 	delta.re = decode_parm(&p);
 	delta.im = decode_parm(&p);
 
 	/* take the chunk offset into account */
-	(*varx) = add_real((*varx), mul_real_int(delta.re, xmin));
-	(*vary) = add_real((*vary), mul_real_int(delta.im, ymin));
+	x = add_real(parm_buf[x_parm_no], mul_real_int(delta.re, xmin));
+	y = add_real(parm_buf[y_parm_no], mul_real_int(delta.im, ymin));
+
+	if (flags & (MS_OPT_STATE | MS_OPT_RESUME)) {
+		ms_pixel_state *sp = (ms_pixel_state *)
+		    (outp + MS_STATE_OFFSET(n_counts, bytes_per_count));
+		bzero(outp + n_counts * bytes_per_count,
+		      (char *)sp - (outp + n_counts * bytes_per_count));
+		mi_count = state_chunk(job, flags, type, x, y, delta.re,
+				       delta.im, parm_buf[k_parm_no],
+				       parm_buf[k_parm_no + 1], xsize, ysize,
+				       outp, bytes_per_count, maxiter, &sp);
+		if (flags & MS_OPT_STATE)
+			datasize = (char *)sp - (char *)&out->reply;
+		out->reply.mi_count = htonl(mi_count);
+		out->reply.precision = htons(REAL_PRECISION);
+		return (datasize);
+	}
+
+	bulbs = (type == FRACTAL_MANDELBROT && !(show_interior && cycle_detect)
+		 && parm_buf[2] == zero_real() && parm_buf[3] == zero_real()
+		 && chunk_meets_bulbs(x, y,
+				      add_real(x,
+					       mul_real_int(delta.re,
+							    xsize - 1)),
+				      add_real(y,
+					       mul_real_int(delta.im,
+							    ysize - 1))));
+	row_loop = bulbs ? bulb_loops[cycle_detect][bytes_per_count - 1] :
+	    fractals[type].row_loops[show_interior][cycle_detect]
+	    [bytes_per_count - 1];
+	precision = REAL_PRECISION;
+#ifdef REAL_DOUBLE
+	if (ladder && !cycle_detect && type <= FRACTAL_JULIA) {
+		double m = 0.0;
+		m = LARGER_ABS(m, x);
+		m = LARGER_ABS(m, y);
+		m = LARGER_ABS(m, x + delta.re * (xsize - 1));
+		m = LARGER_ABS(m, y + delta.im * (ysize - 1));
+		m = LARGER_ABS(m, parm_buf[k_parm_no]);
+		m = LARGER_ABS(m, parm_buf[k_parm_no + 1]);
+		if (precision_enough(FLOAT_BITS, delta.re, m) &&
+		    precision_enough(FLOAT_BITS, delta.im, m)) {
+			row_loop = float_loops[type][bulbs][bytes_per_count - 1];
+			precision = PREC_FLOAT;
+		}
+	}
+#endif
 
-	/* save initial x coordinate for reuse on subsequent scanlines */
-	initial_varx = (*varx);
+	/*
+	   Periodicity checking costs time on every pixel outside the set,
+	   so it is only used for a row if the row above it had some pixels
+	   that reached the iteration limit.  The tolerance is a small
+	   fraction of the pixel size, so a false positive can only happen
+	   at a point that is within a fraction of a pixel of the set anyway.
+	 */
+	periodic_loop = row_loop;
+	if (periodicity && !(show_interior && cycle_detect)) {
+		periodic_loop =
+		    fractals[type].periodic_loops[bulbs][bytes_per_count - 1];
+		period_eps = gteq_real(delta.re, zero_real()) ?
+		    delta.re : sub_real(zero_real(), delta.re);
+		period_eps = mul_real(period_eps, double_to_real(PERIOD_EPS));
+	}
 
-	for (yc = ymin; yc < ymax; yc++) {
-		(*varx) = initial_varx;
+	if (flags & (MS_OPT_GUESS | MS_OPT_GRID)) {
+		guess_setup(xsize, ysize, x, y, delta.re, delta.im,
+			    parm_buf[k_parm_no], parm_buf[k_parm_no + 1], outp,
+			    bytes_per_count, maxiter, row_loop, periodic_loop);
+		mi_count = (flags & MS_OPT_GRID) ?
+		    grid_chunk(xsize, ysize, grid_x, grid_y) :
+		    guess_chunk(xsize, ysize);
+		out->reply.mi_count = htonl(mi_count);
+		out->reply.precision = htons(precision);
+		return ((flags & MS_OPT_PACK) ?
+			pack_reply(out, n_counts, bytes_per_count) : datasize);
+	}
+	chunk.x = x;
+	chunk.dx = delta.re;
+	chunk.k0 = parm_buf[k_parm_no];
+	chunk.k1 = parm_buf[k_parm_no + 1];
+	for (yc = 0; yc < ysize; yc++) {
+		chunk.ys[yc] = y;
+		y = add_real(y, delta.im);
+	}
+	chunk.out = outp;
+	chunk.xsize = xsize;
+	chunk.bytes_per_count = bytes_per_count;
+	chunk.maxiter = maxiter;
+	chunk.row_loop = row_loop;
+	chunk.periodic_loop = periodic_loop;
+	chunk.pixel_row = (unsigned long (*)())0;
+	mi_count = pool_rows(ysize, chunk_row, poll_messages);
+	out->reply.mi_count = htonl(mi_count);
+	out->reply.precision = htons(precision);
+	return ((flags & MS_OPT_PACK) ?
+		pack_reply(out, n_counts, bytes_per_count) : datasize);
+}
 
-		for (xc = xmin; xc < xmax; xc++) {
-#ifdef HENON
-			unsigned int count = henon(parm_buf, maxiter, flags);
-#else
-			unsigned int count =
-			    mandelbrot(parm_buf, maxiter, flags);
+/*
+  Work requests that arrive while a chunk is being calculated are
+  kept on a stack, and the most recent one is calculated first: the
+  older ones are the ones the client is most likely to have sent to
+  another server by now.  When the stack is full, the oldest request
+  is dropped.
+
+  Each reply tells the client how many chunks to keep in flight (see
+  ms_ipc.h).  Two are enough to hide the round trip if it is shorter
+  than a chunk, and a few more are asked for on a large multiprocessor,
+  where the chunks go quickly.  Beyond that, the credit grows by one
+  whenever the server runs out of work and shrinks by one whenever
+  requests pile up, until there is just about one waiting when a chunk
+  is finished, however long the round trip is.  In pipe mode there is
+  no way to tell the requests apart before reading them, so there is
+  no queue and the credit is always 1.
+*/
+#define MAX_QUEUE 32
+#define MIN_CREDIT (2 + (n_threads - 1) / 4)
+#define MAX_CREDIT (MAX_QUEUE / 2)
+
+static struct request {
+	Message in;
+	NET_ADDRESS from;	/* the address of the client */
+} queue[MAX_QUEUE];
+static int n_queued = 0;
+
+static struct request current;	/* the request being calculated */
+static int current_aborted;	/* true if the client has aborted it */
+
+static int isock = 0;		/* where requests come from */
+static int osock;		/* where replies go */
+
+/* true if there is a message waiting to be read from "fd" */
+
+static int input_waiting(fd)
+int fd;
+{
+	fd_set readfds;
+	struct timeval tv;
+	FD_ZERO(&readfds);
+	FD_SET(fd, &readfds);
+	tv.tv_sec = tv.tv_usec = 0;
+	return (select(fd + 1, &readfds, (fd_set *) 0, (fd_set *) 0, &tv) > 0);
+}
+
+/* true if the abort message "a" from "a_from" applies to request "r" */
+
+static int aborts(a, a_from, r)
+AbortMessage *a;
+NET_ADDRESS *a_from;
+struct request *r;
+{
+	unsigned int i, n = ntohs(a->n_chunks);
+	if (r->in.whip.id.pid != a->id.pid || r->in.whip.id.seq != a->id.seq)
+		return (0);
+#ifdef HAVE_SOCKETS
+	if (r->from.sin_addr.s_addr != a_from->sin_addr.s_addr ||
+	    r->from.sin_port != a_from->sin_port)
+		return (0);
 #endif
+	if (n == 0)
+		return (1);
+	if (n > MAX_ABORT_CHUNKS)
+		n = MAX_ABORT_CHUNKS;
+	for (i = 0; i < n; i++)
+		if (a->chunks[i] == r->in.whip.id.chunk_no)
+			return (1);
+	return (0);
+}
 
-			if (maxiter > 256)
-				out->reply.data.shorts[(yc - ymin) * xsize +
-						       (xc - xmin)] =
-				    htons(count);
-			else
-				out->reply.data.chars[(yc - ymin) * xsize +
-						      (xc - xmin)] = count;
-			mi_count += count;
+/*
+  Deal with the message "m": queue a work request, answer a pid
+  inquiry, or drop the requests an abort message applies to.
+*/
 
-			(*varx) = add_real((*varx), delta.re);
+static void handle_message(m)
+struct request *m;
+{
+	int version;
+	int i, j;
+
+	version = ntohs(m->in.generic.header.version);
+	if (ntohs(m->in.generic.header.magic) != MAGIC || version != VERSION)
+		return;
+	switch (ntohs(m->in.generic.header.type)) {
+	case WHIP_MESSAGE:
+		if (n_queued == MAX_QUEUE) {	/* drop the oldest */
+			bcopy((char *)&queue[1], (char *)&queue[0],
+			      (MAX_QUEUE - 1) * sizeof(queue[0]));
+			n_queued--;
 		}
-		(*vary) = add_real((*vary), delta.im);
+		bcopy((char *)m, (char *)&queue[n_queued++], sizeof(*m));
+		break;
+	case WHO_R_U_MESSAGE:
+		{
+			IAmMessage out;
+			m->from.sin_port = m->in.who.port;	/* in network byte order already */
+			out.header = m->in.who.header;
+			out.pid = htons(getpid());
+			out.fractals = htons(fractal_mask());
+			if (SEND(osock, (char *)&out, sizeof(IAmMessage), 0,
+				 (struct sockaddr *)&m->from,
+				 sizeof(m->from)) < 0)
+				error("sending response to pid inquiry");
+		}
+		break;
+	case ABORT_MESSAGE:
+		for (i = j = 0; i < n_queued; i++)
+			if (!aborts(&m->in.abort, &m->from, &queue[i])) {
+				if (j != i)
+					bcopy((char *)&queue[i],
+					      (char *)&queue[j],
+					      sizeof(queue[0]));
+				j++;
+			}
+		n_queued = j;
+		if (aborts(&m->in.abort, &m->from, &current))
+			current_aborted = 1;
+		break;
+	default:;		/* ignore other messages */
 	}
-	out->reply.mi_count = htonl(mi_count);
-	return (datasize);
+}
+
+/*
+  Read the messages that have arrived and deal with them, waiting for
+  one first if "wait" is true.  With HAVE_MMSG, up to RECV_BATCH
+  messages are read with a single system call, and none when there
+  are none, without asking select() first.
+*/
+
+#define RECV_BATCH 16
+
+static struct request inbox[RECV_BATCH];	/* messages just read */
+
+static void receive_messages(wait)
+int wait;
+{
+	int onamelen;
+	int n, i;
+
+#ifdef HAVE_MMSG
+	if (use_sockets) {
+		struct mmsghdr hdrs[RECV_BATCH];
+		struct iovec iov[RECV_BATCH];
+		do {
+			for (i = 0; i < RECV_BATCH; i++) {
+				iov[i].iov_base = (char *)&inbox[i].in;
+				iov[i].iov_len = sizeof(inbox[i].in);
+				bzero((char *)&hdrs[i], sizeof(hdrs[i]));
+				hdrs[i].msg_hdr.msg_name =
+				    (char *)&inbox[i].from;
+				hdrs[i].msg_hdr.msg_namelen =
+				    sizeof(inbox[i].from);
+				hdrs[i].msg_hdr.msg_iov = &iov[i];
+				hdrs[i].msg_hdr.msg_iovlen = 1;
+			}
+			if (wait && timeout != 0)
+				alarm(timeout);
+			n = recvmmsg(isock, hdrs, RECV_BATCH,
+				     wait ? MSG_WAITFORONE : MSG_DONTWAIT,
+				     (struct timespec *)0);
+			if (n < 0) {
+				if (errno == EWOULDBLOCK || errno == EINTR)
+					return;
+				error("receiving datagram packets");
+			}
+			if (!wait && timeout != 0)
+				alarm(timeout);
+			for (i = 0; i < n; i++)
+				handle_message(&inbox[i]);
+			wait = 0;
+		} while (n == RECV_BATCH);
+		return;
+	}
+#endif
+	while (wait || (use_sockets && input_waiting(isock))) {
+		onamelen = sizeof(inbox[0].from);
+		if (timeout != 0)
+			alarm(timeout);
+		/* receive from anywhere, save the address of the caller */
+		if (RECV(isock, (char *)&inbox[0].in, sizeof(inbox[0].in), 0,
+			 (struct sockaddr *)&inbox[0].from, &onamelen) < 0)
+			error("receiving datagram packet");
+		handle_message(&inbox[0]);
+		wait = 0;
+	}
+}
+
+/*
+  Called between the rows of a chunk: deal with the messages that have
+  arrived, at most once a millisecond, and return true if the chunk
+  has been aborted.
+*/
+
+#define POLL_USEC 1000
+
+static int poll_messages()
+{
+	static struct timeval last;
+	struct timeval now;
+
+	if (!use_sockets)
+		return (0);
+	gettimeofday(&now, (struct timezone *)0);
+	if ((now.tv_sec - last.tv_sec) * 1000000L +
+	    (now.tv_usec - last.tv_usec) < POLL_USEC)
+		return (current_aborted);
+	last = now;
+	receive_messages(0);
+	return (current_aborted);
 }
 
 void serve()
 {
-	Message in;
 	Message out;
-	int isock = 0;
-	int osock = use_sockets ? 0 : 1;
+	int credit, min_credit;
 
-	NET_ADDRESS oname;
+	osock = use_sockets ? 0 : 1;
+	min_credit = use_sockets ? MIN_CREDIT : 1;
+	if (min_credit > MAX_CREDIT)
+		min_credit = MAX_CREDIT;
+	credit = min_credit;
 
 	while (1) {
 		unsigned int bytes;
-		int onamelen = sizeof(oname);
-		int version;
-		if (timeout != 0)
-			alarm(timeout);
-		/* receive from anywhere, save the address of the caller in oname */
-		if (RECV(isock, (char *)&in, sizeof(in), 0,
-			 (struct sockaddr *)&oname, &onamelen) < 0)
-			error("receiving datagram packet");
-		version = ntohs(in.generic.header.version);
-		if (ntohs(in.generic.header.magic) == MAGIC
-		    && version == VERSION) {
-			switch (ntohs(in.generic.header.type)) {
-			case WHIP_MESSAGE:
-				/* copy the header and id structures as such while still in */
-				/* network byte order (not strictly portable but probably works) */
-				out.reply.header = in.whip.header;
-				out.reply.id = in.whip.id;
-				/* just the message type needs to be changed */
-				out.reply.header.type = htons(REPLY_MESSAGE);
-				/* calculate() sets the data and mi_count fields */
-				bytes = calculate(&in, &out);
-				if (bytes)
-					if (SEND
-					    (osock, (char *)&out, (int)bytes, 0,
-					     (struct sockaddr *)&oname,
-					     sizeof(oname)) < 0)
-						error
-						    ("sending calculated data");
-				break;
-			case WHO_R_U_MESSAGE:
-				oname.sin_port = in.who.port;	/* in network byte order already */
-				out.iam.header = in.who.header;
-				out.iam.pid = htons(getpid());
-				if (SEND
-				    (osock, (char *)&out, sizeof(IAmMessage), 0,
-				     (struct sockaddr *)&oname,
-				     sizeof(oname)) < 0)
-					error
-					    ("sending response to pid inquiry");
-				break;
-			default:;	/* ignore other messages */
-			}
-		}
+		receive_messages(n_queued == 0);
+		if (n_queued == 0)
+			continue;
+
+		/* calculate the most recent request */
+		bcopy((char *)&queue[--n_queued], (char *)&current,
+		      sizeof(current));
+		current_aborted = 0;
+		/* copy the header and id structures as such while still in */
+		/* network byte order (not strictly portable but probably works) */
+		out.reply.header = current.in.whip.header;
+		out.reply.id = current.in.whip.id;
+		/* just the message type needs to be changed */
+		out.reply.header.type = htons(REPLY_MESSAGE);
+		/* calculate() sets the data, mi_count and precision fields */
+		bytes = calculate(&current.in, &out);
+		if (current_aborted)
+			continue;
+		if (n_queued == 0 && use_sockets && credit < MAX_CREDIT)
+			credit++;
+		else if (n_queued > 1 && credit > min_credit)
+			credit--;
+		out.reply.credit = htons(credit);
+		if (bytes)
+			if (SEND(osock, (char *)&out, (int)bytes, 0,
+				 (struct sockaddr *)&current.from,
+				 sizeof(current.from)) < 0)
+				error("sending calculated data");
 	}
 }
 
@@ -422,11 +1591,31 @@ char **argv;
 		case 'p':	/* pipe mode */
 			use_sockets = 0;
 			break;
+		case 'c':	/* cycle detection */
+			cycle_detect = 1;
+			break;
+		case 's':	/* scalar kernel only */
+			force_scalar = 1;
+			break;
+		case 'b':	/* test for more bulbs */
+			more_bulbs = 1;
+			break;
+		case 'e':	/* exact results: no periodicity checking */
+			periodicity = 0;
+			break;
+		case 'f':	/* full precision: no precision ladder */
+			ladder = 0;
+			break;
+		case 'j':	/* number of threads */
+			n_threads = atoi(*s ? s : (--argc, *++argv));
+			break;
 		default:
 			goto usage;
 		}
 	}
 	nice(niceval);
+	simd_init(force_scalar);
+	pool_init();
 	serve();		/* never returns */
 
  usage:
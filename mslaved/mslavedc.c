@@ -43,6 +43,7 @@
 
 #include "datarep.h"
 #include "ms_ipc.h"
+#include "ms_job.h"
 
 #define RETRIES 5		/* how many times to retry getting a PID in ping() */
 
@@ -69,10 +70,12 @@ char *s;
 /*
   Repeatedly send datagrams to "host" trying to find out the pid of 
   an existing server, if any.  Returns the pid, or 0 if no response.
+  The set of fractal types the server draws is stored in "*fractals".
 */
 
-int ping(host)
+int ping(host, fractals)
 char *host;
+unsigned *fractals;
 {
 	int i;
 	int status;
@@ -140,6 +143,7 @@ char *host;
 			error("receiving pid info");
 		} else {	/* got a reply */
 			status = ntohs(in.iam.pid);
+			*fractals = ntohs(in.iam.fractals);
 			goto done;
 		}
 	}
@@ -158,10 +162,11 @@ char *host;
 int murder()
 {
 	int pid;
+	unsigned fractals;
 	char my_name[256];
 	if (gethostname(my_name, sizeof(my_name)) == 1)
 		error("gethostname");
-	pid = ping(my_name);	/* get pid of existing server, if any */
+	pid = ping(my_name, &fractals);	/* get pid of existing server, if any */
 	if (pid == 0)
 		return (1);	/* return failed exit status */
 	if (kill(pid, SIGTERM) == -1)
@@ -247,15 +252,32 @@ char **argv;
 				break;
 			case 'q':	/* query */
 				{
+					unsigned fractals;
 					int rpid =
 					    ping(s[2] ? s +
-						 2 : (--argc, *++argv));
+						 2 : (--argc, *++argv),
+						 &fractals);
 					if (rpid) {
 						printf("%d\n", rpid);
 						exit(0);
 					} else
 						exit(1);
 				}
+			case 'l':	/* list fractal types */
+				{
+					static char *names[] = FRACTAL_NAMES;
+					unsigned fractals;
+					int i;
+					if (!ping(s[2] ? s +
+						  2 : (--argc, *++argv),
+						  &fractals))
+						exit(1);
+					for (i = 0; i < N_FRACTALS; i++)
+						if (fractals & (1 << i))
+							printf("%s\n",
+							       names[i]);
+					exit(0);
+				}
 			case 't':	/* timeout */
 				timeout_supplied = 1;
 				/* fallthrough */
@@ -290,7 +312,7 @@ char **argv;
 		exit(0);
 	}
  usage:
-	fprintf(stderr, "usage: %s [-k] [-q] [-nnice] [-ttimeout] [-pport]\n",
+	fprintf(stderr, "usage: %s [-k] [-q host] [-l host] [-nnice] [-ttimeout] [-pport]\n",
 		me);
 	exit(1);
 }
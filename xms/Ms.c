@@ -81,22 +81,30 @@ static int endian_magic = 1;
 static Dimension default_width = 400;	/* window width in pixels */
 static Dimension default_height = 250;	/* window height in pixels */
 static int default_iteration_limit = 0;	/* 0 means undefined */
-static double default_center_x = (-0.5);	/* x coordinate of window center */
-static double default_center_y = 0.0;	/* y coordinate of window center */
+static char default_center_x[] = "-0.5";	/* x coordinate of window center */
+static char default_center_y[] = "0.0";	/* y coordinate of window center */
 static double default_range = 4.0;	/* window range in x direction */
 static Bool default_center_box = True;	/* do we center the rubberband box? */
 static Bool default_julia = False;	/* do we show the Julia set? */
 static double default_c_x = 0.0;	/* c parameter for Julia, real */
 static double default_c_y = 0.0;	/* c parameter for Julia, im */
 static double default_julia_range = 4.0;	/* window range for Julia */
-static double default_julia_center_x = 0.0;	/* window center x for Julia */
-static double default_julia_center_y = 0.0;	/* window center y for Julia */
+static char default_julia_center_x[] = "0.0";	/* window center x for Julia */
+static char default_julia_center_y[] = "0.0";	/* window center y for Julia */
 static char default_cursor[] = "top_left_arrow";
 static unsigned default_chunk_width = 32;
 static unsigned default_chunk_height = 32;
 static Bool default_sony_bug_workaround = False;
 static Bool default_crosshair_size = 3;
 static Bool default_show_interior = False;
+static Bool default_guess = False;
+static Bool default_solid_guess = False;
+static unsigned default_guess_samples = 1;
+static Bool default_symmetry = True;
+static Bool default_balance = True;
+static Bool default_deep = False;
+static Bool default_auto_iterations = False;
+static Bool default_exact = False;
 
 extern char msDefaultTranslations[];
 
@@ -151,12 +159,12 @@ static XtResource resources[] = {	/* Core resources */
 	{XtNiteration_limit, XtCValue, XtRInt, sizeof(int),
 	 XtOffset(MsWidget, ms.xi.job.iteration_limit), XtRInt,
 	 (caddr_t) & default_iteration_limit},
-	{XtNCenterX, XtCValue, XtRDouble, sizeof(double),
-	 XtOffset(MsWidget, ms.xi.center_x), XtRDouble,
-	 (caddr_t) & default_center_x},
-	{XtNCenterY, XtCValue, XtRDouble, sizeof(double),
-	 XtOffset(MsWidget, ms.xi.center_y), XtRDouble,
-	 (caddr_t) & default_center_y},
+	{XtNCenterX, XtCValue, XtRString, sizeof(String),
+	 XtOffset(MsWidget, ms.center_x), XtRString,
+	 (caddr_t) default_center_x},
+	{XtNCenterY, XtCValue, XtRString, sizeof(String),
+	 XtOffset(MsWidget, ms.center_y), XtRString,
+	 (caddr_t) default_center_y},
 	{XtNRange, XtCValue, XtRDouble, sizeof(double),
 	 XtOffset(MsWidget, ms.xi.xrange), XtRDouble,
 	 (caddr_t) & default_range},
@@ -197,7 +205,31 @@ static XtResource resources[] = {	/* Core resources */
 	 (caddr_t) & default_crosshair_size},
 	{XtNInterior, XtCValue, XtRBool, sizeof(Bool),
 	 XtOffset(MsWidget, ms.xi.show_interior), XtRBool,
-	 (caddr_t) & default_show_interior}
+	 (caddr_t) & default_show_interior},
+	{XtNGuess, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.guess), XtRBool,
+	 (caddr_t) & default_guess},
+	{XtNSolidGuess, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.solid_guess), XtRBool,
+	 (caddr_t) & default_solid_guess},
+	{XtNGuessSamples, XtCValue, XtRInt, sizeof(unsigned int),
+	 XtOffset(MsWidget, ms.xi.guess_samples), XtRInt,
+	 (caddr_t) & default_guess_samples},
+	{XtNSymmetry, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.symmetry), XtRBool,
+	 (caddr_t) & default_symmetry},
+	{XtNBalance, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.balance), XtRBool,
+	 (caddr_t) & default_balance},
+	{XtNDeep, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.deep), XtRBool,
+	 (caddr_t) & default_deep},
+	{XtNExact, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.exact), XtRBool,
+	 (caddr_t) & default_exact},
+	{XtNAutoIterations, XtCValue, XtRBool, sizeof(Bool),
+	 XtOffset(MsWidget, ms.xi.auto_iterations), XtRBool,
+	 (caddr_t) & default_auto_iterations}
 
 };
 
@@ -249,6 +281,21 @@ MsClassRec msClassRec = {	/* core fields */
 
 WidgetClass msWidgetClass = (WidgetClass) & msClassRec;
 
+/*
+  The center_x and center_y resources are strings, so that they can
+  have more digits than a double.  They are converted to the view
+  center as soon as they are set, and then cleared, since they may
+  point to storage of the caller's.
+*/
+
+static void TakeCenter(w)
+MsWidget w;
+{
+	ms_set_center(&w->ms.xi, (char *)w->ms.center_x,
+		      (char *)w->ms.center_y);
+	w->ms.center_x = w->ms.center_y = (String) NULL;
+}
+
 /* Initialize the widget */
 
 static void Initialize(request, new)
@@ -280,7 +327,9 @@ MsWidget new;
 	new->ms.underflow = 0;
 	new->ms.underflow_label = NULL;
 #endif
+	new->ms.xi.fractal = FRACTAL_MANDELBROT;
 	ms_init(&new->ms.xi, (char *)new, MamaWorkforce(new->ms.mama));
+	TakeCenter(new);
 
 	XtAddCallback((Widget) new, XtNdestroyCallback,
 		      (XtCallbackProc) Die, (caddr_t) 0);
@@ -296,13 +345,18 @@ MsWidget w;
 {
 	int underflow;
 	XVisualInfo *vi = MamaVisualInfo(w->ms.mama);
+
+	/* the chunks of the old configuration are of no use any more */
+	wf_cancel(MamaWorkforce(w->ms.mama), (char *)&w->ms.xi);
+
 	w->ms.xi.height = w->core.height;
 	w->ms.xi.width = w->core.width;
 
 	ms_calculate_job_parameters(&w->ms.xi, &w->ms.xi.job);
 
 #ifdef LABEL
-	underflow = (w->ms.xi.job.delta.re == 0 || w->ms.xi.job.delta.im == 0);
+	underflow = (w->ms.xi.job.delta.re == 0 || w->ms.xi.job.delta.im == 0)
+	    && !w->ms.xi.deep_limbs && !w->ms.xi.mp_limbs;
 
 	if (underflow && !w->ms.underflow) {
 		MsCreateUnderflowLabel(w);
@@ -323,11 +377,11 @@ MsWidget w;
 		XDestroyImage(w->ms.rectbuffer);
 	}
 
-	/* create the rectangle buffer */
-	w->ms.rectbuffer = XCreateImage(XtDisplay(w), vi->visual, vi->depth, ZPixmap, 0, (char *)NULL, w->ms.xi.chunk_width, w->ms.xi.chunk_height, 32, 0	/* zero means let XCreateImage determine bytes/line */
+	/* create the rectangle buffer, large enough for a block of chunks */
+	w->ms.rectbuffer = XCreateImage(XtDisplay(w), vi->visual, vi->depth, ZPixmap, 0, (char *)NULL, MS_MERGE * w->ms.xi.chunk_width, MS_MERGE * w->ms.xi.chunk_height, 32, 0	/* zero means let XCreateImage determine bytes/line */
 	    );
 	w->ms.rectbuffer_size = (unsigned)w->ms.rectbuffer->bytes_per_line *
-	    w->ms.xi.chunk_height;
+	    MS_MERGE * w->ms.xi.chunk_height;
 	w->ms.rectbuffer->data = (char *)XtMalloc(w->ms.rectbuffer_size);
 
 	if (w->ms.xi.job.iteration_limit == 0) {	/* not set yet? *//* iterate as far as possible by default */
@@ -444,6 +498,9 @@ int outwards;
 	struct box b;
 	double scale;
 	double new_xrange, new_center_x, new_center_y;
+	mpfix new_re, new_im, offset;
+	char new_x_text[MS_COORD_TEXT_SIZE], new_y_text[MS_COORD_TEXT_SIZE];
+	double dx, dy;
 	Arg arglist[16];
 	int num_args;
 	Arg shell_arglist[16];
@@ -468,23 +525,30 @@ int outwards;
 	if (outwards) {		/* zoom out */
 		if (boxwidth == 0) {	/* avoid division by zero */
 			new_xrange = default_range;
-			new_center_x = w->ms.xi.center_x;
-			new_center_y = w->ms.xi.center_y;
+			dx = dy = 0.0;
 		} else {
 			scale = (double)w->core.width / (double)boxwidth;
 			new_xrange = w->ms.xi.xrange * scale;
-			new_center_x =
-			    w->ms.xi.center_x - nx * scale * w->ms.xi.xrange;
-			new_center_y =
-			    w->ms.xi.center_y - ny * scale * w->ms.xi.yrange;
+			dx = -nx * scale * w->ms.xi.xrange;
+			dy = -ny * scale * w->ms.xi.yrange;
 		}
 	} else {		/* zoom in */
 		scale = (double)boxwidth / (double)(w->core.width);
 		new_xrange = w->ms.xi.xrange * scale;
-		new_center_x = w->ms.xi.center_x + nx * w->ms.xi.xrange;
-		new_center_y = w->ms.xi.center_y + ny * w->ms.xi.yrange;
+		dx = nx * w->ms.xi.xrange;
+		dy = ny * w->ms.xi.yrange;
 	}
 
+	/* move the center to full precision, and pass it on as text */
+	mp_from_double(&offset, dx, MP_MAX_LIMBS);
+	mp_add(&new_re, &w->ms.xi.center_re, &offset);
+	mp_from_double(&offset, dy, MP_MAX_LIMBS);
+	mp_add(&new_im, &w->ms.xi.center_im, &offset);
+	ms_coordinate_text(new_x_text, &new_re, new_xrange / w->core.width);
+	ms_coordinate_text(new_y_text, &new_im, new_xrange / w->core.width);
+	new_center_x = mp_to_double(&new_re);
+	new_center_y = mp_to_double(&new_im);
+
 	/* build arguments for the changed resources in the zoomed widget */
 	num_args = 0;
 
@@ -501,18 +565,16 @@ int outwards;
 		XtSetArg(arglist[num_args], XtNRange,
 			 dbl_arg(&default_julia_range));
 		num_args++;
-		XtSetArg(arglist[num_args], XtNCenterX,
-			 dbl_arg(&default_julia_center_x));
+		XtSetArg(arglist[num_args], XtNCenterX, default_julia_center_x);
 		num_args++;
-		XtSetArg(arglist[num_args], XtNCenterY,
-			 dbl_arg(&default_julia_center_y));
+		XtSetArg(arglist[num_args], XtNCenterY, default_julia_center_y);
 		num_args++;
 	} else {		/* No change in M/J mode */
 		XtSetArg(arglist[num_args], XtNJulia, w->ms.xi.julia);
 		num_args++;
-		XtSetArg(arglist[num_args], XtNCenterX, dbl_arg(&new_center_x));
+		XtSetArg(arglist[num_args], XtNCenterX, new_x_text);
 		num_args++;
-		XtSetArg(arglist[num_args], XtNCenterY, dbl_arg(&new_center_y));
+		XtSetArg(arglist[num_args], XtNCenterY, new_y_text);
 		num_args++;
 		XtSetArg(arglist[num_args], XtNRange, dbl_arg(&new_xrange));
 		num_args++;
@@ -716,6 +778,7 @@ MsWidget w;
 static Boolean SetValues(current, request, new)
 MsWidget current, request, new;
 {
+	TakeCenter(new);
 	MsPrecalculate(new);	/* do the dirty work */
 	return (True);		/* widget must be redisplayed */
 }
@@ -733,17 +796,23 @@ MsWidget w;
 void WindowStats(w)
 MsWidget w;
 {
-	(void)printf("current picture area: x = %f .. %f, y = %f .. %f\n",
-		     w->ms.xi.center_x - w->ms.xi.xrange / 2,
-		     w->ms.xi.center_x + w->ms.xi.xrange / 2,
-		     w->ms.xi.center_y - w->ms.xi.yrange / 2,
-		     w->ms.xi.center_y + w->ms.xi.yrange / 2);
+	char x_text[MS_COORD_TEXT_SIZE], y_text[MS_COORD_TEXT_SIZE];
+	double spacing = w->ms.xi.xrange / w->core.width;
+	double center_x = mp_to_double(&w->ms.xi.center_re);
+	double center_y = mp_to_double(&w->ms.xi.center_im);
+	(void)printf("current picture area: x = %g .. %g, y = %g .. %g\n",
+		     center_x - w->ms.xi.xrange / 2,
+		     center_x + w->ms.xi.xrange / 2,
+		     center_y - w->ms.xi.yrange / 2,
+		     center_y + w->ms.xi.yrange / 2);
 	(void)printf("return here with: xms ");
 	if (w->ms.xi.julia)
 		(void)printf("-julia -cx %f -cy %f ", w->ms.xi.c_x,
 			     w->ms.xi.c_y);
-	(void)printf("-x %f -y %f -range %f\n", w->ms.xi.center_x,
-		     w->ms.xi.center_y, w->ms.xi.xrange);
+	(void)printf("-x %s -y %s -range %g\n",
+		     ms_coordinate_text(x_text, &w->ms.xi.center_re, spacing),
+		     ms_coordinate_text(y_text, &w->ms.xi.center_im, spacing),
+		     w->ms.xi.xrange);
 }
 
 /* Action routine for the above */
@@ -22,6 +22,14 @@
 #define XtNSony		"sony_bug_workaround"
 #define XtNCrosshairSize "crosshair_size"
 #define XtNInterior	"interior"
+#define XtNGuess	"guess"
+#define XtNSolidGuess	"solid_guess"
+#define XtNGuessSamples	"guess_samples"
+#define XtNSymmetry	"symmetry"
+#define XtNBalance	"balance"
+#define XtNDeep		"deep"
+#define XtNExact	"exact"
+#define XtNAutoIterations "auto_iterations"
 
 typedef struct _MsRec *MsWidget;
 typedef struct _MsClassRec *MsWidgetClass;
@@ -19,6 +19,8 @@ struct box {
 /* widget instance structure */
 typedef struct {
 	ms_state xi;		/* X-independent stuff */
+	String center_x;	/* new view center as set, or NULL (see below) */
+	String center_y;
 	GC box_gc;		/* GC for the rubberband box */
 	GC blit_gc;		/* GC for image drawing */
 	XPoint box_origin;
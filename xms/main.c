@@ -58,6 +58,14 @@ static XrmOptionDescRec options[] = {
 	{"-wrap", "*wrap", XrmoptionNoArg, "True"},
 	{"-nowrap", "*wrap", XrmoptionNoArg, "False"},
 	{"-interior", "*interior", XrmoptionNoArg, "True"},
+	{"-guess", "*guess", XrmoptionNoArg, "True"},
+	{"-solid_guess", "*solid_guess", XrmoptionNoArg, "True"},
+	{"-guess_samples", "*guess_samples", XrmoptionSepArg, NULL},
+	{"-nosymmetry", "*symmetry", XrmoptionNoArg, "False"},
+	{"-nobalance", "*balance", XrmoptionNoArg, "False"},
+	{"-deep", "*deep", XrmoptionNoArg, "True"},
+	{"-exact", "*exact", XrmoptionNoArg, "True"},
+	{"-auto_iterations", "*auto_iterations", XrmoptionNoArg, "True"},
 	{"-sony", "*sony_bug_workaround",
 	 XrmoptionNoArg, "True"},
 	{"-crosshair_size", "*ms_1*crosshair_size",